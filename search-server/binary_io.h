@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// Native byte order encoding of trivially copyable values, shared by the log and network formats
+
+template <typename Buffer, typename Value>
+void PutValue(Buffer& data, Value value) {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    data.insert(data.end(), bytes, bytes + sizeof(Value));
+}
+
+template <typename Buffer>
+void PutString(Buffer& data, std::string_view text) {
+    PutValue(data, static_cast<uint32_t>(text.size()));
+    data.insert(data.end(), text.begin(), text.end());
+}
+
+template <typename Value>
+bool GetValue(std::string_view& data, Value& value) {
+    if (data.size() < sizeof(Value)) return false;
+    std::memcpy(&value, data.data(), sizeof(Value));
+    data.remove_prefix(sizeof(Value));
+    return true;
+}
+
+inline bool GetString(std::string_view& data, std::string_view& text) {
+    uint32_t size = 0;
+    if (!GetValue(data, size) || data.size() < size) return false;
+    text = data.substr(0, size);
+    data.remove_prefix(size);
+    return true;
+}
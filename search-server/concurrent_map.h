@@ -1,54 +1,340 @@
+#pragma once
 #include <algorithm>
-#include <cstdlib>
-#include <future>
-#include <map>
-#include <numeric>
-#include <string>
-#include <vector>
-#include <map>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
-#include <tuple>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-using namespace std::string_literals;
+// Hash map with integer keys updated from many threads.
+// Keys are spread over shards, each shard is an open-addressing table with linear probing on its own cache lines.
+// Inserts and Add run under a shared shard lock: a free slot is claimed with a CAS and arithmetic values are atomics,
+// so threads hitting one shard don't wait for each other. Erase, Update and growth take the shard exclusively.
+// The shards and their initial slots are two allocations from the given resource, made and freed by the constructing
+// thread, so a per-query arena works; only shards outgrowing expected_size allocate again, from the heap
 template <typename Key, typename Value>
 class ConcurrentMap {
 public:
     static_assert(std::is_integral_v<Key>, "ConcurrentMap supports only integer keys");
 
-    struct Bucket {
-        std::mutex mutex;
-        std::map<Key, Value> map;
+    // Enough shards for every hardware thread to work in its own one most of the time
+    static size_t GetDefaultShardCount() {
+        return std::max<size_t>(1, std::thread::hardware_concurrency()) * 4;
+    }
 
-    };
+    explicit ConcurrentMap(size_t expected_size = 0, size_t shard_count = GetDefaultShardCount(),
+                           std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : shard_bits_(GetShardBits(shard_count))
+        , shards_(size_t{ 1 } << shard_bits_, resource)
+        , resource_(resource) {
+        const size_t shard_capacity = GetCapacity(expected_size / shards_.size() * 4 / 3 + 1);
+        initial_slot_count_ = shards_.size() * shard_capacity;
+        initial_slots_ = static_cast<Slot*>(resource_->allocate(initial_slot_count_ * sizeof(Slot), alignof(Slot)));
+        std::uninitialized_default_construct_n(initial_slots_, initial_slot_count_);
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            shards_[i].Reset(initial_slots_ + i * shard_capacity, shard_capacity);
+        }
+    }
+
+    ~ConcurrentMap() {
+        std::destroy_n(initial_slots_, initial_slot_count_);
+        resource_->deallocate(initial_slots_, initial_slot_count_ * sizeof(Slot), alignof(Slot));
+    }
+
+    ConcurrentMap(const ConcurrentMap&) = delete;
+    ConcurrentMap& operator=(const ConcurrentMap&) = delete;
+
+    // Adds delta to the value of the key, inserting it with value delta if absent
+    void Add(Key key, Value delta) {
+        static_assert(std::is_arithmetic_v<Value>, "Add needs an arithmetic value");
+        const uint64_t hash = Hash(key);
+        Shard& shard = GetShard(hash);
+        while (true) {
+            {
+                std::shared_lock lock(shard.mutex);
+                bool inserted = false;
+                if (Slot* slot = shard.FindOrClaim(key, hash >> shard_bits_, delta, inserted)) {
+                    if (!inserted) AddAtomic(slot->value, delta);
+                    return;
+                }
+            }
+            std::unique_lock lock(shard.mutex);
+            shard.GrowIfFull(shard_bits_);
+        }
+    }
+
+    // Calls updater(Value&) with the shard locked, the value is default constructed if absent
+    template <typename Updater>
+    void Update(Key key, Updater updater) {
+        const uint64_t hash = Hash(key);
+        Shard& shard = GetShard(hash);
+        std::unique_lock lock(shard.mutex);
+        bool inserted = false;
+        Slot* slot = shard.FindOrClaim(key, hash >> shard_bits_, Value{}, inserted);
+        if (!slot) {
+            shard.GrowIfFull(shard_bits_);
+            slot = shard.FindOrClaim(key, hash >> shard_bits_, Value{}, inserted);
+        }
+        if constexpr (std::is_arithmetic_v<Value>) {
+            Value value = slot->value.load(std::memory_order_relaxed);
+            updater(value);
+            slot->value.store(value, std::memory_order_relaxed);
+        }
+        else {
+            updater(slot->value);
+        }
+    }
 
-    struct Access {
-        Access(Bucket& val, const Key& key) : guard(val.mutex), ref_to_value(val.map[key]) {}
-        std::lock_guard<std::mutex> guard;
-        Value& ref_to_value;
+    std::optional<Value> Find(Key key) const {
+        const uint64_t hash = Hash(key);
+        const Shard& shard = GetShard(hash);
+        std::shared_lock lock(shard.mutex);
+        const Slot* slot = shard.Find(key, hash >> shard_bits_);
+        if (!slot) return std::nullopt;
+        return LoadValue(*slot);
+    }
+
+    void Erase(Key key) {
+        const uint64_t hash = Hash(key);
+        Shard& shard = GetShard(hash);
+        std::unique_lock lock(shard.mutex);
+        if (Slot* slot = shard.Find(key, hash >> shard_bits_)) {
+            slot->state.store(ERASED, std::memory_order_relaxed);
+            if constexpr (!std::is_arithmetic_v<Value>) slot->value = Value{};
+            shard.size.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    size_t GetSize() const {
+        size_t size = 0;
+        for (const Shard& shard : shards_) {
+            size += shard.size.load(std::memory_order_relaxed);
+        }
+        return size;
+    }
+
+    // Calls callback(key, value) for every element in place, shard by shard
+    template <typename Callback>
+    void ForEach(Callback callback) const {
+        for (const Shard& shard : shards_) {
+            std::shared_lock lock(shard.mutex);
+            for (size_t j = 0; j < shard.capacity; ++j) {
+                const Slot& slot = shard.slots[j];
+                if (slot.state.load(std::memory_order_acquire) == FULL) callback(slot.key, LoadValue(slot));
+            }
+        }
+    }
+
+    // Moves all elements out in no particular order and leaves the map empty
+    std::vector<std::pair<Key, Value>> Extract() {
+        std::vector<std::pair<Key, Value>> result;
+        result.reserve(GetSize());
+        for (Shard& shard : shards_) {
+            std::unique_lock lock(shard.mutex);
+            for (size_t j = 0; j < shard.capacity; ++j) {
+                Slot& slot = shard.slots[j];
+                if (slot.state.load(std::memory_order_relaxed) == FULL) {
+                    if constexpr (std::is_arithmetic_v<Value>) {
+                        result.emplace_back(slot.key, slot.value.load(std::memory_order_relaxed));
+                    }
+                    else {
+                        result.emplace_back(slot.key, std::move(slot.value));
+                    }
+                }
+            }
+            shard.Clear();
+        }
+        return result;
+    }
+
+private:
+    enum State : uint8_t {
+        EMPTY,
+        // Claimed by an inserting thread, the key is not written yet
+        BUSY,
+        FULL,
+        ERASED,
     };
 
-    explicit ConcurrentMap(size_t bucket_count) : dsize(bucket_count), dictionaries(bucket_count) {};
+    using StoredValue = std::conditional_t<std::is_arithmetic_v<Value>, std::atomic<Value>, Value>;
 
-    Access operator[](const Key& key) {
-        uint64_t key64 = static_cast<uint64_t>(key);
-        auto dnumber = key64 % dsize;
-        return Access{ dictionaries[dnumber], key };
+    struct Slot {
+        std::atomic<State> state{ EMPTY };
+        Key key{};
+        StoredValue value{};
     };
 
-    std::map<Key, Value> BuildOrdinaryMap() {
-        std::map<Key, Value> result; 
-        for (auto& dictionary : dictionaries) {
-            std::lock_guard guard(dictionary.mutex);
-            result.insert(dictionary.map.begin(), dictionary.map.end());
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        // Part of the initial block of the map until the shard grows
+        Slot* slots = nullptr;
+        size_t capacity = 0;
+        std::unique_ptr<Slot[]> grown_slots;
+        // Slots ever claimed since the last rehash, erased ones included
+        std::atomic<size_t> used = 0;
+        std::atomic<size_t> size = 0;
+
+        void Reset(Slot* new_slots, size_t new_capacity) {
+            slots = new_slots;
+            capacity = new_capacity;
+            used.store(0, std::memory_order_relaxed);
+            size.store(0, std::memory_order_relaxed);
+        }
+
+        // Empties the shard keeping its slots, called with the shard locked exclusively
+        void Clear() {
+            for (size_t i = 0; i < capacity; ++i) {
+                slots[i].state.store(EMPTY, std::memory_order_relaxed);
+                if constexpr (!std::is_arithmetic_v<Value>) slots[i].value = Value{};
+            }
+            Reset(slots, capacity);
+        }
+
+        Slot* Find(Key key, uint64_t hash) const {
+            for (size_t i = hash & (capacity - 1), probes = 0; probes < capacity; i = (i + 1) & (capacity - 1), ++probes) {
+                const State state = WaitWritten(slots[i]);
+                if (state == EMPTY) return nullptr;
+                if (state == FULL && slots[i].key == key) return &slots[i];
+            }
+            return nullptr;
+        }
+
+        // Returns the slot of the key, an absent key is inserted with the initial value.
+        // nullptr means the shard is too full and must grow first
+        Slot* FindOrClaim(Key key, uint64_t hash, const Value& initial, bool& inserted) {
+            for (size_t i = hash & (capacity - 1), probes = 0; probes < capacity; i = (i + 1) & (capacity - 1), ++probes) {
+                Slot& slot = slots[i];
+                State state = WaitWritten(slot);
+                if (state == FULL && slot.key == key) return &slot;
+                if (state != EMPTY) continue;
+                // Reserve before claiming so that concurrent inserts never fill the table
+                if (used.fetch_add(1, std::memory_order_relaxed) + 1 > capacity * 3 / 4) {
+                    used.fetch_sub(1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+                if (slot.state.compare_exchange_strong(state, BUSY, std::memory_order_acquire)) {
+                    slot.key = key;
+                    if constexpr (std::is_arithmetic_v<Value>) {
+                        slot.value.store(initial, std::memory_order_relaxed);
+                    }
+                    else {
+                        slot.value = initial;
+                    }
+                    slot.state.store(FULL, std::memory_order_release);
+                    size.fetch_add(1, std::memory_order_relaxed);
+                    inserted = true;
+                    return &slot;
+                }
+                used.fetch_sub(1, std::memory_order_relaxed);
+                // Another thread took the slot, look at it again: it may be the same key
+                state = WaitWritten(slot);
+                if (state == FULL && slot.key == key) return &slot;
+            }
+            return nullptr;
+        }
+
+        // Called with the shard locked exclusively
+        void GrowIfFull(size_t shard_bits) {
+            if (used.load(std::memory_order_relaxed) + 1 <= capacity * 3 / 4) return;
+            Slot* const old_slots = slots;
+            const size_t old_capacity = capacity;
+            // Frees the previous heap slots on return, initial ones stay in the block until the map is destroyed
+            const std::unique_ptr<Slot[]> old_grown_slots = std::move(grown_slots);
+            const size_t live = size.load(std::memory_order_relaxed);
+            const size_t new_capacity = GetCapacity(std::max(live * 2, old_capacity * 3 / 4 + 1));
+            grown_slots = std::make_unique<Slot[]>(new_capacity);
+            Reset(grown_slots.get(), new_capacity);
+            for (size_t i = 0; i < old_capacity; ++i) {
+                Slot& old_slot = old_slots[i];
+                if (old_slot.state.load(std::memory_order_relaxed) != FULL) continue;
+                size_t j = Hash(old_slot.key) >> shard_bits & (capacity - 1);
+                while (slots[j].state.load(std::memory_order_relaxed) != EMPTY) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                slots[j].key = old_slot.key;
+                if constexpr (std::is_arithmetic_v<Value>) {
+                    slots[j].value.store(old_slot.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                }
+                else {
+                    slots[j].value = std::move(old_slot.value);
+                }
+                slots[j].state.store(FULL, std::memory_order_relaxed);
+            }
+            used.store(live, std::memory_order_relaxed);
+            size.store(live, std::memory_order_relaxed);
+        }
+
+        static State WaitWritten(const Slot& slot) {
+            State state = slot.state.load(std::memory_order_acquire);
+            while (state == BUSY) {
+                std::this_thread::yield();
+                state = slot.state.load(std::memory_order_acquire);
+            }
+            return state;
         }
-        return result;
     };
-    void erase(const Key& key) {
-        uint64_t key64 = static_cast<uint64_t>(key);
-        auto dnumber = key64 % dsize;
-        dictionaries[dnumber].map.erase(key);
+
+    const size_t shard_bits_;
+    std::pmr::vector<Shard> shards_;
+    std::pmr::memory_resource* const resource_;
+    Slot* initial_slots_ = nullptr;
+    size_t initial_slot_count_ = 0;
+
+    static size_t GetShardBits(size_t shard_count) {
+        size_t shard_bits = 0;
+        while ((size_t{ 1 } << shard_bits) < shard_count) {
+            ++shard_bits;
+        }
+        return shard_bits;
     }
-private:
-    uint32_t dsize;
-    std::vector<Bucket> dictionaries; 
-};
\ No newline at end of file
+
+    // Power of two keeping min_capacity slots under the 3/4 load limit
+    static size_t GetCapacity(size_t min_capacity) {
+        size_t capacity = 8;
+        while (capacity * 3 < min_capacity * 4) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    static uint64_t Hash(Key key) {
+        // Finalizer of splitmix64: consecutive keys land far apart
+        uint64_t hash = static_cast<uint64_t>(key);
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+        return hash ^ (hash >> 31);
+    }
+
+    Shard& GetShard(uint64_t hash) {
+        return shards_[hash & ((size_t{ 1 } << shard_bits_) - 1)];
+    }
+
+    const Shard& GetShard(uint64_t hash) const {
+        return shards_[hash & ((size_t{ 1 } << shard_bits_) - 1)];
+    }
+
+    static void AddAtomic(std::atomic<Value>& value, Value delta) {
+        if constexpr (std::is_integral_v<Value>) {
+            value.fetch_add(delta, std::memory_order_relaxed);
+        }
+        else {
+            Value expected = value.load(std::memory_order_relaxed);
+            while (!value.compare_exchange_weak(expected, expected + delta, std::memory_order_relaxed)) {}
+        }
+    }
+
+    static Value LoadValue(const Slot& slot) {
+        if constexpr (std::is_arithmetic_v<Value>) {
+            return slot.value.load(std::memory_order_relaxed);
+        }
+        else {
+            return slot.value;
+        }
+    }
+};
@@ -0,0 +1,274 @@
+// Stress check and contention benchmark of ConcurrentMap.
+// The stress check hammers maps from many threads (inserts during growth, adds to the same keys,
+// erases racing with adds, locked updates) and compares them with sums counted by the threads, exit code 1 on mismatch.
+// The benchmark compares Add with buckets of std::map under a mutex (the previous ConcurrentMap)
+// and one std::unordered_map under a mutex, for keys spread over a large range and for a few hot keys.
+//
+// Usage: concurrent_map_benchmark [--threads N] [--operations N] [--skip-stress]
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "concurrent_map.h"
+
+using namespace std::literals;
+
+namespace {
+// What ConcurrentMap was before: a fixed number of buckets, each a std::map under a mutex
+class BucketMap {
+public:
+    explicit BucketMap(size_t bucket_count)
+        : buckets_(bucket_count) {}
+
+    void Add(int key, double delta) {
+        Bucket& bucket = buckets_[static_cast<unsigned>(key) % buckets_.size()];
+        std::lock_guard guard(bucket.mutex);
+        bucket.map[key] += delta;
+    }
+
+private:
+    struct Bucket {
+        std::mutex mutex;
+        std::map<int, double> map;
+    };
+
+    std::vector<Bucket> buckets_;
+};
+
+class LockedMap {
+public:
+    void Add(int key, double delta) {
+        std::lock_guard guard(mutex_);
+        map_[key] += delta;
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<int, double> map_;
+};
+
+template <typename Function>
+void RunThreads(int thread_count, Function function) {
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+    for (int thread = 0; thread < thread_count; ++thread) {
+        threads.emplace_back(function, thread);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// How many of the operations 0..operation_count - 1 go to the key when operation i goes to i % key_count
+long long CountOperations(int key, int operation_count, int key_count) {
+    return operation_count / key_count + (key < operation_count % key_count ? 1 : 0);
+}
+
+bool Check(bool condition, const std::string& name) {
+    std::cout << (condition ? "OK   "s : "FAIL "s) << name << std::endl;
+    return condition;
+}
+
+// Adds from all threads to random keys, the map starts empty so shards grow while others insert
+bool CheckAdds(int thread_count, int operation_count) {
+    const int key_count = 50000;
+    ConcurrentMap<int, long long> map;
+    std::vector<std::vector<long long>> expected(thread_count, std::vector<long long>(key_count));
+    RunThreads(thread_count, [&](int thread) {
+        std::mt19937 generator(thread);
+        std::uniform_int_distribution<int> keys(0, key_count - 1);
+        for (int i = 0; i < operation_count; ++i) {
+            const int key = keys(generator);
+            const int delta = i % 3 + 1;
+            map.Add(key, delta);
+            expected[thread][key] += delta;
+        }
+    });
+    bool ok = true;
+    size_t present_count = 0;
+    for (int key = 0; key < key_count; ++key) {
+        long long sum = 0;
+        for (int thread = 0; thread < thread_count; ++thread) {
+            sum += expected[thread][key];
+        }
+        const std::optional<long long> value = map.Find(key);
+        if (sum == 0) {
+            ok = ok && !value;
+        }
+        else {
+            ok = ok && value == sum;
+            ++present_count;
+        }
+    }
+    ok = ok && map.GetSize() == present_count;
+    size_t visited_count = 0;
+    map.ForEach([&](int key, long long) {
+        ++visited_count;
+        ok = ok && key >= 0 && key < key_count;
+    });
+    return Check(ok && visited_count == present_count, "integer adds during growth"s);
+}
+
+// All threads add halves to the same few keys, sums of halves are exact in double
+bool CheckHotKeys(int thread_count, int operation_count) {
+    const int key_count = 4;
+    ConcurrentMap<int, double> map(key_count);
+    RunThreads(thread_count, [&](int) {
+        for (int i = 0; i < operation_count; ++i) {
+            map.Add(i % key_count, 0.5);
+        }
+    });
+    bool ok = true;
+    for (int key = 0; key < key_count; ++key) {
+        ok = ok && map.Find(key) == 0.5 * thread_count * CountOperations(key, operation_count, key_count);
+    }
+    return Check(ok, "double adds to hot keys"s);
+}
+
+// Odd keys are erased while being added to, even keys must keep exact sums.
+// Erased keys come back on the next add, so their value is at most the number of adds
+bool CheckErases(int thread_count, int operation_count) {
+    const int key_count = 10000;
+    ConcurrentMap<int, long long> map;
+    const int adder_count = std::max(1, thread_count - 1);
+    RunThreads(adder_count + 1, [&](int thread) {
+        if (thread == adder_count) {
+            for (int round = 0; round < 20; ++round) {
+                for (int key = 1; key < key_count; key += 2) {
+                    map.Erase(key);
+                }
+            }
+            return;
+        }
+        for (int i = 0; i < operation_count; ++i) {
+            map.Add(i % key_count, 1);
+        }
+    });
+    bool ok = true;
+    for (int key = 0; key < key_count; ++key) {
+        const long long add_count = adder_count * CountOperations(key, operation_count, key_count);
+        const std::optional<long long> value = map.Find(key);
+        if (key % 2 == 0) {
+            ok = ok && (add_count == 0 ? !value : value == add_count);
+        }
+        else {
+            ok = ok && (!value || (*value > 0 && *value <= add_count));
+        }
+    }
+    for (int key = 1; key < key_count; key += 2) {
+        map.Erase(key);
+    }
+    const size_t even_count = std::min(key_count, operation_count) / 2 + std::min(key_count, operation_count) % 2;
+    ok = ok && map.GetSize() == even_count;
+    std::vector<std::pair<int, long long>> extracted = map.Extract();
+    ok = ok && extracted.size() == even_count && map.GetSize() == 0 && !map.Find(0);
+    map.Add(0, 1);
+    ok = ok && map.Find(0) == 1;
+    return Check(ok, "erases racing with adds"s);
+}
+
+// Values that are not arithmetic are changed under the shard lock
+bool CheckUpdates(int thread_count, int operation_count) {
+    const int key_count = 1000;
+    ConcurrentMap<int, std::vector<int>> map;
+    RunThreads(thread_count, [&](int thread) {
+        for (int i = 0; i < operation_count; ++i) {
+            map.Update(i % key_count, [thread](std::vector<int>& values) {
+                values.push_back(thread);
+            });
+        }
+    });
+    bool ok = map.GetSize() == static_cast<size_t>(std::min(key_count, operation_count));
+    for (const auto& [key, values] : map.Extract()) {
+        std::vector<int> counts(thread_count);
+        for (const int thread : values) {
+            ++counts[thread];
+        }
+        for (int thread = 0; thread < thread_count; ++thread) {
+            ok = ok && counts[thread] == CountOperations(key, operation_count, key_count);
+        }
+    }
+    return Check(ok, "locked updates"s);
+}
+
+template <typename Map>
+double MeasureAdds(Map& map, int thread_count, int operation_count, int key_count) {
+    std::vector<std::vector<int>> keys(thread_count);
+    for (int thread = 0; thread < thread_count; ++thread) {
+        std::mt19937 generator(thread);
+        std::uniform_int_distribution<int> distribution(0, key_count - 1);
+        keys[thread].resize(operation_count);
+        std::generate(keys[thread].begin(), keys[thread].end(), [&] { return distribution(generator); });
+    }
+    const auto start = std::chrono::steady_clock::now();
+    RunThreads(thread_count, [&](int thread) {
+        for (const int key : keys[thread]) {
+            map.Add(key, 1.0);
+        }
+    });
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return thread_count * static_cast<double>(operation_count) / elapsed.count() / 1e6;
+}
+
+void Benchmark(int max_thread_count, int operation_count) {
+    std::cout << std::endl << "Million adds per second"s << std::endl;
+    std::cout << std::setw(8) << "threads"s << std::setw(8) << "keys"s << std::setw(16) << "ConcurrentMap"s
+        << std::setw(16) << "map buckets"s << std::setw(16) << "locked map"s << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (const int key_count : { 1000000, 16 }) {
+        for (int thread_count = 1; thread_count <= max_thread_count; thread_count *= 2) {
+            ConcurrentMap<int, double> concurrent_map;
+            BucketMap bucket_map(10000);
+            LockedMap locked_map;
+            std::cout << std::setw(8) << thread_count << std::setw(8) << key_count
+                << std::setw(16) << MeasureAdds(concurrent_map, thread_count, operation_count, key_count)
+                << std::setw(16) << MeasureAdds(bucket_map, thread_count, operation_count, key_count)
+                << std::setw(16) << MeasureAdds(locked_map, thread_count, operation_count, key_count) << std::endl;
+        }
+    }
+}
+}
+
+int main(int argc, char* argv[]) {
+    int thread_count = std::max(4, static_cast<int>(std::thread::hardware_concurrency()));
+    int operation_count = 1000000;
+    bool skip_stress = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg == "--threads"sv && i + 1 < argc) {
+            thread_count = std::stoi(argv[++i]);
+        }
+        else if (arg == "--operations"sv && i + 1 < argc) {
+            operation_count = std::stoi(argv[++i]);
+        }
+        else if (arg == "--skip-stress"sv) {
+            skip_stress = true;
+        }
+        else {
+            std::cerr << "Usage: concurrent_map_benchmark [--threads N] [--operations N] [--skip-stress]"s << std::endl;
+            return 2;
+        }
+    }
+    if (thread_count < 1 || operation_count < 1) {
+        std::cerr << "Thread and operation counts must be positive"s << std::endl;
+        return 2;
+    }
+
+    if (!skip_stress) {
+        bool ok = CheckAdds(thread_count, operation_count);
+        ok = CheckHotKeys(thread_count, operation_count) && ok;
+        ok = CheckErases(thread_count, operation_count) && ok;
+        ok = CheckUpdates(thread_count, operation_count / 10) && ok;
+        if (!ok) return 1;
+    }
+    Benchmark(thread_count, operation_count);
+}
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <charconv>
+#include <exception>
+#include <execution>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "corpus_loader.h"
+
+namespace {
+// Chunks per hardware thread, so uneven chunks still balance
+const size_t CHUNKS_PER_THREAD = 8;
+const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+std::string_view TakeField(std::string_view& line) {
+    const size_t end = std::min(line.find('\t'), line.size());
+    const std::string_view field = line.substr(0, end);
+    line.remove_prefix(std::min(end + 1, line.size()));
+    return field;
+}
+
+int ParseNumber(std::string_view text) {
+    int value = 0;
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size()) throw std::invalid_argument("Bad number in corpus");
+    return value;
+}
+
+DocumentStatus ParseStatus(std::string_view text) {
+    if (text == "ACTUAL") return DocumentStatus::ACTUAL;
+    if (text == "IRRELEVANT") return DocumentStatus::IRRELEVANT;
+    if (text == "BANNED") return DocumentStatus::BANNED;
+    if (text == "REMOVED") return DocumentStatus::REMOVED;
+    throw std::invalid_argument("Bad document status in corpus");
+}
+
+DocumentRecord ParseRecord(std::string_view line) {
+    DocumentRecord record;
+    record.id = ParseNumber(TakeField(line));
+    record.status = ParseStatus(TakeField(line));
+    for (std::string_view rating : SplitIntoWordsView(TakeField(line))) {
+        record.ratings.push_back(ParseNumber(rating));
+    }
+    record.text = line;
+    return record;
+}
+
+void ParseChunk(std::string_view chunk, std::vector<DocumentRecord>& records) {
+    while (!chunk.empty()) {
+        const size_t end = std::min(chunk.find('\n'), chunk.size());
+        std::string_view line = chunk.substr(0, end);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (!line.empty()) records.push_back(ParseRecord(line));
+        chunk.remove_prefix(std::min(end + 1, chunk.size()));
+    }
+}
+}
+
+MappedFile::MappedFile(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Can't open " + path);
+    struct stat file_stat {};
+    if (::fstat(fd, &file_stat) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Can't stat " + path);
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ > 0) {
+        void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Can't map " + path);
+        }
+        // The advice values are not flags, each one needs a call of its own
+        if (::madvise(data, size_, MADV_SEQUENTIAL) != 0 || ::madvise(data, size_, MADV_WILLNEED) != 0) {
+            ::munmap(data, size_);
+            ::close(fd);
+            throw std::runtime_error("Can't advise the mapping of " + path);
+        }
+        data_ = static_cast<const char*>(data);
+    }
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) ::munmap(const_cast<char*>(data_), size_);
+}
+
+std::string_view MappedFile::GetData() const {
+    return { data_, size_ };
+}
+
+std::vector<DocumentRecord> ParseCorpus(std::string_view data) {
+    // Chunk borders are moved forward to the next line start
+    const size_t chunk_count = std::max<size_t>(1, std::min(data.size() / MIN_CHUNK_SIZE, std::max(1u, std::thread::hardware_concurrency()) * CHUNKS_PER_THREAD));
+    std::vector<std::string_view> chunks;
+    size_t begin = 0;
+    for (size_t i = 1; i <= chunk_count && begin < data.size(); ++i) {
+        size_t end = i == chunk_count ? data.size() : std::max(begin, data.size() * i / chunk_count);
+        end = std::min(data.find('\n', end), data.size());
+        end = std::min(end + 1, data.size());
+        chunks.push_back(data.substr(begin, end - begin));
+        begin = end;
+    }
+
+    std::vector<std::vector<DocumentRecord>> chunk_records(chunks.size());
+    std::vector<std::exception_ptr> errors(chunks.size());
+    std::for_each(
+        std::execution::par,
+        chunks.begin(), chunks.end(),
+        [&](const std::string_view& chunk) {
+            const size_t index = &chunk - chunks.data();
+            try {
+                ParseChunk(chunk, chunk_records[index]);
+            }
+            catch (...) {
+                errors[index] = std::current_exception();
+            }
+        }
+    );
+    for (const auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+
+    std::vector<DocumentRecord> records;
+    size_t record_count = 0;
+    for (const auto& part : chunk_records) {
+        record_count += part.size();
+    }
+    records.reserve(record_count);
+    for (auto& part : chunk_records) {
+        std::move(part.begin(), part.end(), std::back_inserter(records));
+    }
+    return records;
+}
+
+size_t LoadCorpus(SearchServer& search_server, const std::string& path, int shard, int shard_count) {
+    const auto file = std::make_shared<const MappedFile>(path);
+    std::vector<DocumentRecord> records = ParseCorpus(file->GetData());
+    if (shard_count > 1) {
+        records.erase(std::remove_if(records.begin(), records.end(),
+            [shard, shard_count](const DocumentRecord& record) {
+                return GetDocumentShard(record.id, shard_count) != shard;
+            }), records.end());
+    }
+    search_server.AddDocuments(records, file);
+    return records.size();
+}
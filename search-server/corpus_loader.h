@@ -0,0 +1,37 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view GetData() const;
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Corpus is a text file with one document per line:
+// <id>\t<ACTUAL|IRRELEVANT|BANNED|REMOVED>\t<ratings separated by spaces>\t<text>
+// Chunks of the data are parsed in parallel, texts of the records point into data
+std::vector<DocumentRecord> ParseCorpus(std::string_view data);
+// Maps the file and adds its documents, the server keeps the mapping alive instead of copying texts.
+// With shard_count > 1 only documents of the shard (see GetDocumentShard) are added.
+// Returns the number of added documents
+size_t LoadCorpus(SearchServer& search_server, const std::string& path, int shard = 0, int shard_count = 1);
+
+// Shard owning the document when a corpus is split between shard_count servers
+inline int GetDocumentShard(int document_id, int shard_count) {
+    return static_cast<int>(static_cast<unsigned>(document_id) % static_cast<unsigned>(shard_count));
+}
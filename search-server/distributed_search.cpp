@@ -0,0 +1,371 @@
+// Coordinator of a corpus split between search_daemon shards (search_daemon --shard K/N).
+// Serves clients with the protocol of search_daemon: queries go to every shard and are merged,
+// updates go to the shard owning the document. Every client connection gets its own thread and shard connections.
+//
+// The self check starts local shard daemons, fills them and a single SearchServer with the same documents
+// and compares the results, then stops and kills a shard to check partial results.
+//
+// Usage: distributed_search <socket path | tcp:port> --shards addr1,addr2,... [--timeout-ms N]
+//        distributed_search --self-check [--daemon path] [--shards N] [--documents N]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "corpus_loader.h"
+#include "search_coordinator.h"
+#include "search_protocol.h"
+#include "search_server.h"
+
+using namespace std::literals;
+
+namespace {
+std::vector<std::string> SplitAddresses(std::string_view text) {
+    std::vector<std::string> result;
+    while (!text.empty()) {
+        const size_t comma = text.find(',');
+        if (comma != 0) result.emplace_back(text.substr(0, comma));
+        if (comma == std::string_view::npos) break;
+        text.remove_prefix(comma + 1);
+    }
+    return result;
+}
+
+Response Execute(SearchCoordinator& coordinator, const Request& request) {
+    Response response;
+    response.request_id = request.request_id;
+    response.type = request.type;
+    try {
+        switch (request.type) {
+        case RequestType::FIND: {
+            DistributedResult result = coordinator.FindTopDocuments(request.text, request.mode, request.status);
+            if (!result.missing_shards.empty()) {
+                std::cerr << "Query answered without "s << result.missing_shards.size() << " shard(s)"s << std::endl;
+            }
+            response.documents = std::move(result.documents);
+            break;
+        }
+        case RequestType::MATCH: {
+            auto [words, status] = coordinator.MatchDocument(request.text, request.document_id);
+            response.words = std::move(words);
+            response.status = status;
+            break;
+        }
+        case RequestType::ADD:
+            coordinator.AddDocument(request.document_id, request.text, request.status, request.ratings);
+            break;
+        case RequestType::REMOVE:
+            coordinator.RemoveDocument(request.document_id);
+            break;
+        case RequestType::STATS:
+            throw std::invalid_argument("STATS is served by shards only");
+        }
+    }
+    catch (const std::exception& e) {
+        response.ok = false;
+        response.error = e.what();
+    }
+    return response;
+}
+
+void ServeConnection(int fd, std::vector<std::string> shard_addresses, std::chrono::milliseconds timeout) {
+    SearchCoordinator coordinator(std::move(shard_addresses), timeout);
+    std::string input;
+    char chunk[1 << 16];
+    for (ssize_t size; (size = ::read(fd, chunk, sizeof(chunk))) > 0;) {
+        input.append(chunk, static_cast<size_t>(size));
+        std::string_view data = input;
+        std::string output;
+        try {
+            for (Request request; DecodeRequest(data, request);) {
+                EncodeResponse(Execute(coordinator, request), output);
+            }
+        }
+        catch (const std::invalid_argument&) {
+            break;
+        }
+        input.erase(0, input.size() - data.size());
+        for (std::string_view rest = output; !rest.empty();) {
+            const ssize_t sent = ::send(fd, rest.data(), rest.size(), MSG_NOSIGNAL);
+            if (sent < 0) {
+                ::close(fd);
+                return;
+            }
+            rest.remove_prefix(static_cast<size_t>(sent));
+        }
+    }
+    ::close(fd);
+}
+
+int Serve(const std::string& address, const std::vector<std::string>& shard_addresses, std::chrono::milliseconds timeout) {
+    std::signal(SIGPIPE, SIG_IGN);
+    const int listen_fd = ListenSocket(address);
+    std::cerr << "Coordinating "s << shard_addresses.size() << " shards"s << std::endl;
+    for (int fd; (fd = ::accept(listen_fd, nullptr, nullptr)) >= 0;) {
+        std::thread(ServeConnection, fd, shard_addresses, timeout).detach();
+    }
+    return 1;
+}
+
+std::string GenerateWord(std::mt19937& generator, int max_length) {
+    const int length = std::uniform_int_distribution(1, max_length)(generator);
+    std::string word;
+    for (int i = 0; i < length; ++i) {
+        word.push_back(static_cast<char>(std::uniform_int_distribution('a', 'z')(generator)));
+    }
+    return word;
+}
+
+std::string GenerateQuery(std::mt19937& generator, const std::vector<std::string>& dictionary) {
+    std::string query;
+    const int word_count = std::uniform_int_distribution(1, 4)(generator);
+    for (int i = 0; i < word_count; ++i) {
+        if (!query.empty()) query.push_back(' ');
+        const std::string& word = dictionary[std::uniform_int_distribution<size_t>(0, dictionary.size() - 1)(generator)];
+        switch (std::uniform_int_distribution(0, 9)(generator)) {
+        case 0:
+            query += "-"s + word;
+            break;
+        case 1:
+            query += "+"s + word;
+            break;
+        case 2:
+            query += word.substr(0, 2) + "*"s;
+            break;
+        default:
+            query += word;
+        }
+    }
+    return query;
+}
+
+// Ties are broken by id both by a single server and by the coordinator, so the documents must match in order
+bool HaveSameRanking(const std::vector<Document>& lhs, const std::vector<Document>& rhs) {
+    if (lhs.size() != rhs.size()) return false;
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        if (lhs[i].id != rhs[i].id || std::abs(lhs[i].relevance - rhs[i].relevance) > 1e-9 || lhs[i].rating != rhs[i].rating) return false;
+    }
+    return true;
+}
+
+struct StoredDocument {
+    std::string text;
+    DocumentStatus status;
+    std::vector<int> ratings;
+};
+
+const std::string STOP_WORDS = "and in on with"s;
+
+// Reference server holding the documents of the given shards
+SearchServer MakeReference(const std::map<int, StoredDocument>& documents, int shard_count, const std::vector<int>& shards) {
+    SearchServer search_server(STOP_WORDS);
+    for (const auto& [document_id, document] : documents) {
+        if (std::count(shards.begin(), shards.end(), GetDocumentShard(document_id, shard_count))) {
+            search_server.AddDocument(document_id, document.text, document.status, document.ratings);
+        }
+    }
+    return search_server;
+}
+
+// Compares the coordinator with the reference on random queries, returns the number of mismatches
+int CompareQueries(SearchCoordinator& coordinator, const SearchServer& reference, std::mt19937& generator,
+    const std::vector<std::string>& dictionary, int query_count, const std::vector<int>& expected_missing) {
+    int mismatch_count = 0;
+    for (int i = 0; i < query_count; ++i) {
+        const std::string query = GenerateQuery(generator, dictionary);
+        const QueryMode mode = i % 3 == 0 ? QueryMode::ALL : QueryMode::ANY;
+        const DocumentStatus status = i % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        const DistributedResult result = coordinator.FindTopDocuments(query, mode, status);
+        const std::vector<Document> expected = reference.FindTopDocuments(query, mode, status);
+        if (result.missing_shards != expected_missing || !HaveSameRanking(result.documents, expected)) {
+            std::cerr << "Mismatch on \""s << query << "\""s << std::endl;
+            ++mismatch_count;
+        }
+    }
+    return mismatch_count;
+}
+
+pid_t StartShard(const std::string& daemon_path, const std::string& address) {
+    const pid_t pid = ::fork();
+    if (pid == 0) {
+        ::execl(daemon_path.c_str(), daemon_path.c_str(), address.c_str(), "--stop-words", STOP_WORDS.c_str(), "--workers", "2", nullptr);
+        std::cerr << "Can't run "s << daemon_path << std::endl;
+        ::_exit(127);
+    }
+    if (pid < 0) throw std::runtime_error("Can't fork");
+    return pid;
+}
+
+void WaitForShard(const std::string& address) {
+    for (int attempt = 0;; ++attempt) {
+        try {
+            ::close(ConnectSocket(address));
+            return;
+        }
+        catch (const std::runtime_error&) {
+            if (attempt == 250) throw;
+            std::this_thread::sleep_for(20ms);
+        }
+    }
+}
+
+int SelfCheck(const std::string& daemon_path, int shard_count, int document_count) {
+    std::vector<std::string> addresses;
+    std::vector<pid_t> pids;
+    for (int i = 0; i < shard_count; ++i) {
+        addresses.push_back("/tmp/distributed_search."s + std::to_string(::getpid()) + "."s + std::to_string(i) + ".sock"s);
+        pids.push_back(StartShard(daemon_path, addresses.back()));
+    }
+
+    int failure_count = 0;
+    auto check = [&failure_count](bool condition, std::string_view what) {
+        std::cerr << (condition ? "ok    "sv : "FAIL  "sv) << what << std::endl;
+        failure_count += !condition;
+    };
+    try {
+        for (const std::string& address : addresses) {
+            WaitForShard(address);
+        }
+        std::mt19937 generator;
+        std::vector<std::string> dictionary;
+        for (int i = 0; i < 500; ++i) {
+            dictionary.push_back(GenerateWord(generator, 8));
+        }
+        SearchCoordinator coordinator(addresses, 300ms);
+        std::map<int, StoredDocument> documents;
+        for (int document_id = 0; document_id < document_count; ++document_id) {
+            StoredDocument document;
+            for (int i = std::uniform_int_distribution(1, 30)(generator); i > 0; --i) {
+                if (!document.text.empty()) document.text.push_back(' ');
+                document.text += dictionary[std::uniform_int_distribution<size_t>(0, dictionary.size() - 1)(generator)];
+            }
+            document.status = document_id % 7 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+            document.ratings = { std::uniform_int_distribution(-100, 100)(generator), std::uniform_int_distribution(-100, 100)(generator) };
+            coordinator.AddDocument(document_id, document.text, document.status, document.ratings);
+            documents[document_id] = std::move(document);
+        }
+        for (int document_id = 0; document_id < document_count; document_id += 11) {
+            coordinator.RemoveDocument(document_id);
+            documents.erase(document_id);
+        }
+
+        std::vector<int> all_shards(shard_count);
+        for (int i = 0; i < shard_count; ++i) {
+            all_shards[i] = i;
+        }
+        check(CompareQueries(coordinator, MakeReference(documents, shard_count, all_shards), generator, dictionary, 1000, {}) == 0,
+            "results of all shards match a single server"sv);
+
+        const auto [words, status] = coordinator.MatchDocument(documents.begin()->second.text, documents.begin()->first);
+        check(!words.empty() && status == documents.begin()->second.status, "match is routed to the owner shard"sv);
+
+        bool rejected = false;
+        try {
+            coordinator.FindTopDocuments("cat --dog"sv);
+        }
+        catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        check(rejected, "invalid query is rejected"sv);
+
+        const int stopped_shard = shard_count - 1;
+        std::vector<int> other_shards(all_shards.begin(), all_shards.end() - 1);
+        const SearchServer partial_reference = MakeReference(documents, shard_count, other_shards);
+        ::kill(pids[stopped_shard], SIGSTOP);
+        check(CompareQueries(coordinator, partial_reference, generator, dictionary, 5, { stopped_shard }) == 0,
+            "stopped shard is left out after the timeout"sv);
+        ::kill(pids[stopped_shard], SIGCONT);
+        check(CompareQueries(coordinator, MakeReference(documents, shard_count, all_shards), generator, dictionary, 100, {}) == 0,
+            "resumed shard is used again"sv);
+
+        ::kill(pids[stopped_shard], SIGKILL);
+        ::waitpid(pids[stopped_shard], nullptr, 0);
+        pids[stopped_shard] = -1;
+        check(CompareQueries(coordinator, partial_reference, generator, dictionary, 100, { stopped_shard }) == 0,
+            "killed shard is left out"sv);
+        bool unavailable = false;
+        try {
+            coordinator.AddDocument(document_count * shard_count + stopped_shard, "cat"sv, DocumentStatus::ACTUAL, { 1 });
+        }
+        catch (const std::runtime_error&) {
+            unavailable = true;
+        }
+        check(unavailable, "update of a killed shard fails"sv);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        ++failure_count;
+    }
+
+    for (const pid_t pid : pids) {
+        if (pid < 0) continue;
+        ::kill(pid, SIGCONT);
+        ::kill(pid, SIGTERM);
+        ::waitpid(pid, nullptr, 0);
+    }
+    for (const std::string& address : addresses) {
+        ::unlink(address.c_str());
+    }
+    return failure_count == 0 ? 0 : 1;
+}
+}
+
+int main(int argc, char* argv[]) {
+    const std::string usage = "Usage: "s + argv[0] + " <socket path | tcp:port> --shards addr1,addr2,... [--timeout-ms N]\n"s
+        + "       "s + argv[0] + " --self-check [--daemon path] [--shards N] [--documents N]"s;
+    if (argc < 2) {
+        std::cerr << usage << std::endl;
+        return 1;
+    }
+    const bool self_check = argv[1] == "--self-check"sv;
+    std::string shards;
+    std::string daemon_path = "./search_daemon"s;
+    std::chrono::milliseconds timeout = 1000ms;
+    int document_count = 3000;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        const std::string_view name = argv[i];
+        if (name == "--shards"sv) {
+            shards = argv[i + 1];
+        }
+        else if (name == "--timeout-ms"sv) {
+            timeout = std::chrono::milliseconds(std::stoi(argv[i + 1]));
+        }
+        else if (name == "--daemon"sv) {
+            daemon_path = argv[i + 1];
+        }
+        else if (name == "--documents"sv) {
+            document_count = std::max(1, std::stoi(argv[i + 1]));
+        }
+        else {
+            std::cerr << "Unknown option "s << name << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        if (self_check) {
+            return SelfCheck(daemon_path, shards.empty() ? 3 : std::max(2, std::stoi(shards)), document_count);
+        }
+        const std::vector<std::string> shard_addresses = SplitAddresses(shards);
+        if (shard_addresses.empty()) {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+        return Serve(argv[1], shard_addresses, timeout);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
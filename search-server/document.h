@@ -1,4 +1,6 @@
 #pragma once
+#include <string_view>
+#include <vector>
 
 struct Document {
     Document();
@@ -16,6 +18,14 @@ enum class DocumentStatus {
     REMOVED,
 };
 
+// Document as read from a corpus, the text is owned by the caller
+struct DocumentRecord {
+    int id = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+    std::string_view text;
+};
+
 struct DocumentData {
     int rating;
     DocumentStatus status;
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <map>
+
+#include "index_segment.h"
+
+IndexSegment::IndexSegment(std::vector<Posting> postings, bool impact_ordered) {
+    std::sort(postings.begin(), postings.end(), [](const Posting& lhs, const Posting& rhs) {
+        return lhs.word_id != rhs.word_id ? lhs.word_id < rhs.word_id : lhs.document_id < rhs.document_id;
+    });
+    document_ids_.reserve(postings.size());
+    sequences_.reserve(postings.size());
+    term_freqs_.reserve(postings.size());
+    std::set<uint32_t> sequences;
+    for (const Posting& posting : postings) {
+        if (word_ids_.empty() || word_ids_.back() != posting.word_id) {
+            word_ids_.push_back(posting.word_id);
+            offsets_.push_back(document_ids_.size());
+        }
+        document_ids_.push_back(posting.document_id);
+        sequences_.push_back(posting.sequence);
+        term_freqs_.push_back(posting.term_freq);
+        sequences.insert(posting.sequence);
+    }
+    offsets_.push_back(document_ids_.size());
+    document_count_ = sequences.size();
+
+    if (impact_ordered) {
+        impact_order_.reserve(document_ids_.size());
+        for (size_t index = 0; index < word_ids_.size(); ++index) {
+            const size_t begin = offsets_[index];
+            const size_t size = offsets_[index + 1] - begin;
+            for (size_t i = 0; i < size; ++i) {
+                impact_order_.push_back(static_cast<uint32_t>(i));
+            }
+            const double* term_freqs = &term_freqs_[begin];
+            std::stable_sort(impact_order_.end() - size, impact_order_.end(), [term_freqs](uint32_t lhs, uint32_t rhs) {
+                return term_freqs[lhs] > term_freqs[rhs];
+            });
+        }
+    }
+}
+
+IndexSegment::Postings IndexSegment::FindPostings(int word_id) const {
+    const auto it = std::lower_bound(word_ids_.begin(), word_ids_.end(), word_id);
+    if (it == word_ids_.end() || *it != word_id) return { nullptr, nullptr, nullptr, 0, nullptr };
+    const size_t index = it - word_ids_.begin();
+    const size_t begin = offsets_[index];
+    const uint32_t* impact_order = impact_order_.empty() ? nullptr : &impact_order_[begin];
+    return { &document_ids_[begin], &sequences_[begin], &term_freqs_[begin], offsets_[index + 1] - begin, impact_order };
+}
+
+size_t IndexSegment::GetDocumentCount() const {
+    return document_count_;
+}
+
+size_t IndexSegment::GetPostingCount() const {
+    return document_ids_.size();
+}
+
+std::shared_ptr<const IndexSegment> IndexSegment::Merge(const std::vector<std::shared_ptr<const IndexSegment>>& segments, const std::set<uint32_t>& removed_sequences, std::set<uint32_t>& dropped_sequences, bool impact_ordered) {
+    std::vector<Posting> postings;
+    size_t posting_count = 0;
+    for (const auto& segment : segments) {
+        posting_count += segment->GetPostingCount();
+    }
+    postings.reserve(posting_count);
+    for (const auto& segment : segments) {
+        for (size_t index = 0; index < segment->word_ids_.size(); ++index) {
+            for (size_t i = segment->offsets_[index]; i < segment->offsets_[index + 1]; ++i) {
+                if (removed_sequences.count(segment->sequences_[i]) == 0) {
+                    postings.push_back({ segment->word_ids_[index], segment->document_ids_[i], segment->sequences_[i], segment->term_freqs_[i] });
+                }
+                else {
+                    dropped_sequences.insert(segment->sequences_[i]);
+                }
+            }
+        }
+    }
+    return std::make_shared<const IndexSegment>(std::move(postings), impact_ordered);
+}
+
+SegmentSet::SegmentSet() : merger_([this] { MergeLoop(); }) {}
+
+SegmentSet::~SegmentSet() {
+    {
+        std::lock_guard guard(mutex_);
+        stop_ = true;
+    }
+    changed_.notify_all();
+    merger_.join();
+}
+
+void SegmentSet::Add(std::shared_ptr<const IndexSegment> segment) {
+    {
+        std::lock_guard guard(mutex_);
+        segments_.push_back(std::move(segment));
+    }
+    changed_.notify_all();
+}
+
+void SegmentSet::MarkRemoved(uint32_t sequence) {
+    std::lock_guard guard(mutex_);
+    removed_sequences_.insert(sequence);
+}
+
+SegmentSet::Segments SegmentSet::GetSegments() const {
+    std::lock_guard guard(mutex_);
+    return segments_;
+}
+
+void SegmentSet::SetImpactOrdered(bool impact_ordered) {
+    std::lock_guard guard(mutex_);
+    impact_ordered_ = impact_ordered;
+}
+
+bool SegmentSet::IsImpactOrdered() const {
+    std::lock_guard guard(mutex_);
+    return impact_ordered_;
+}
+
+void SegmentSet::WaitForMerges() {
+    std::unique_lock lock(mutex_);
+    changed_.wait(lock, [this] { return !merging_ && PickSegmentsToMerge().empty(); });
+}
+
+void SegmentSet::MergeLoop() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+        changed_.wait(lock, [this] { return stop_ || !PickSegmentsToMerge().empty(); });
+        if (stop_) return;
+
+        const Segments to_merge = PickSegmentsToMerge();
+        const std::set<uint32_t> removed_sequences = removed_sequences_;
+        const bool impact_ordered = impact_ordered_;
+        merging_ = true;
+        lock.unlock();
+        std::set<uint32_t> dropped_sequences;
+        const auto merged = IndexSegment::Merge(to_merge, removed_sequences, dropped_sequences, impact_ordered);
+        lock.lock();
+        merging_ = false;
+
+        auto new_end = std::remove_if(segments_.begin(), segments_.end(), [&to_merge](const auto& segment) {
+            return std::find(to_merge.begin(), to_merge.end(), segment) != to_merge.end();
+        });
+        segments_.erase(new_end, segments_.end());
+        if (merged->GetPostingCount() > 0) segments_.push_back(merged);
+        // A document lives in exactly one segment, so its removal mark is no longer needed once merged away
+        for (const uint32_t sequence : dropped_sequences) {
+            removed_sequences_.erase(sequence);
+        }
+        changed_.notify_all();
+    }
+}
+
+SegmentSet::Segments SegmentSet::PickSegmentsToMerge() const {
+    std::map<int, Segments> tiers;
+    for (const auto& segment : segments_) {
+        int tier = 0;
+        for (size_t size = MUTABLE_SEGMENT_DOCUMENT_COUNT * SEGMENT_MERGE_FACTOR; segment->GetDocumentCount() >= size; size *= SEGMENT_MERGE_FACTOR) {
+            ++tier;
+        }
+        tiers[tier].push_back(segment);
+    }
+    for (auto& [tier, segments] : tiers) {
+        if (segments.size() >= SEGMENT_MERGE_FACTOR) {
+            segments.resize(SEGMENT_MERGE_FACTOR);
+            return segments;
+        }
+    }
+    return {};
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+// Documents are indexed in a small mutable segment which is frozen into an IndexSegment once it holds this many documents
+const int MUTABLE_SEGMENT_DOCUMENT_COUNT = 4096;
+// Segments of one size tier are merged when there are this many of them
+const int SEGMENT_MERGE_FACTOR = 4;
+
+// Immutable read-optimized part of the index: postings of all words are stored flat, ordered by word id and document id
+class IndexSegment {
+public:
+    struct Posting {
+        int word_id;
+        int document_id;
+        // Tells postings of a removed document from postings of a document later added with the same id
+        uint32_t sequence;
+        double term_freq;
+    };
+
+    struct Postings {
+        const int* document_ids;
+        const uint32_t* sequences;
+        const double* term_freqs;
+        size_t size;
+        // Positions of the postings by descending term frequency, nullptr if the segment has no impact order
+        const uint32_t* impact_order;
+    };
+
+    explicit IndexSegment(std::vector<Posting> postings, bool impact_ordered = false);
+
+    Postings FindPostings(int word_id) const;
+    size_t GetDocumentCount() const;
+    size_t GetPostingCount() const;
+    // Combines the segments dropping postings of removed documents, the sequences actually dropped are added to dropped_sequences
+    static std::shared_ptr<const IndexSegment> Merge(const std::vector<std::shared_ptr<const IndexSegment>>& segments, const std::set<uint32_t>& removed_sequences, std::set<uint32_t>& dropped_sequences, bool impact_ordered);
+
+private:
+    std::vector<int> word_ids_;
+    std::vector<size_t> offsets_;
+    std::vector<int> document_ids_;
+    std::vector<uint32_t> sequences_;
+    std::vector<double> term_freqs_;
+    std::vector<uint32_t> impact_order_;
+    size_t document_count_ = 0;
+};
+
+// Set of frozen segments with a background thread merging them under a tiered policy.
+// Readers take a snapshot of the current segments, which stays valid while merges replace them
+class SegmentSet {
+public:
+    using Segments = std::vector<std::shared_ptr<const IndexSegment>>;
+
+    SegmentSet();
+    ~SegmentSet();
+
+    void Add(std::shared_ptr<const IndexSegment> segment);
+    // Postings of the document are dropped by the next merge of its segment
+    void MarkRemoved(uint32_t sequence);
+    Segments GetSegments() const;
+    // Whether merges build impact order of postings
+    void SetImpactOrdered(bool impact_ordered);
+    bool IsImpactOrdered() const;
+    // Blocks until the merge policy has nothing left to merge
+    void WaitForMerges();
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    Segments segments_;
+    std::set<uint32_t> removed_sequences_;
+    bool merging_ = false;
+    bool impact_ordered_ = false;
+    bool stop_ = false;
+    std::thread merger_;
+
+    void MergeLoop();
+    // Segments of the lowest tier that has enough of them, empty if none
+    Segments PickSegmentsToMerge() const;
+};
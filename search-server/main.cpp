@@ -1,9 +1,21 @@
 #include "search_server.h"
+#include "corpus_loader.h"
 #include "log_duration.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <chrono>
 #include <execution>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
 #include <iostream>
 #include <random>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 using namespace std;
 string GenerateWord(mt19937& generator, int max_length) {
@@ -48,7 +60,7 @@ vector<string> GenerateQueries(mt19937& generator, const vector<string>& diction
 template <typename ExecutionPolicy>
 void Test(string_view mark, const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&& policy) {
     
-    LOG_DURATION(std::string(mark));
+    LOG_DURATION(std::string{ mark });
     double total_relevance = 0;
     for (const string_view query : queries) {
         for (const auto& document : search_server.FindTopDocuments(policy, query)) {
@@ -57,16 +69,681 @@ void Test(string_view mark, const SearchServer& search_server, const vector<stri
     }
     cout << total_relevance << endl;
 }
+void TestQueryMode(string_view mark, const SearchServer& search_server, const vector<string>& queries, QueryMode mode) {
+    LOG_DURATION(std::string{ mark });
+    double total_relevance = 0;
+    for (const string_view query : queries) {
+        for (const auto& document : search_server.FindTopDocuments(query, mode)) {
+            total_relevance += document.relevance;
+        }
+    }
+    cout << total_relevance << endl;
+}
+void TestBudget(const SearchServer& search_server, const vector<string>& queries, size_t posting_count) {
+    vector<SearchResult> results;
+    {
+        LOG_DURATION("budget "s + (posting_count == numeric_limits<size_t>::max() ? "unlimited"s : to_string(posting_count)));
+        for (const string_view query : queries) {
+            results.push_back(search_server.FindTopDocumentsWithin(query, { chrono::steady_clock::duration::max(), posting_count }));
+        }
+    }
+    size_t found_count = 0;
+    size_t exact_count = 0;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const auto exact = search_server.FindTopDocuments(queries[i]);
+        const SearchResult& result = results[i];
+        for (const auto& document : exact) {
+            found_count += count_if(result.documents.begin(), result.documents.end(),
+                [&document](const Document& found) { return found.id == document.id; });
+        }
+        exact_count += exact.size();
+    }
+    const double recall = exact_count ? static_cast<double>(found_count) / exact_count : 1.0;
+    cout << "recall "s << recall << endl;
+    // Without a limit the anytime search is exact, equal documents are ordered by id on both paths
+    assert(posting_count != numeric_limits<size_t>::max() || recall == 1.0);
+}
+// Once the arena has grown to the largest query, repeating the queries takes nothing from the heap
+void TestQueryArenaReuse(const SearchServer& search_server, const vector<string>& queries) {
+    const auto run_queries = [&] {
+        for (const string& query : queries) {
+            search_server.FindTopDocuments(query);
+            search_server.FindTopDocuments(query, QueryMode::ALL);
+            search_server.FindTopDocumentsWithin(query, { chrono::steady_clock::duration::max(), 10'000 });
+        }
+    };
+    run_queries();
+    const size_t warm_allocation_count = search_server.GetAllocatorStatistics().query_heap.allocation_count;
+    for (int i = 0; i < 10; ++i) {
+        run_queries();
+    }
+    const size_t allocation_count = search_server.GetAllocatorStatistics().query_heap.allocation_count - warm_allocation_count;
+    cout << "query arena allocations after warm-up: "s << allocation_count << " in "s << queries.size() * 30 << " queries"s << endl;
+    assert(allocation_count == 0);
+}
+// Required words keep their meaning in the anytime search
+void TestRequiredWordsWithin() {
+    SearchServer search_server(""s);
+    search_server.AddDocument(1, "cat dog"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(2, "dog bird"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(3, "fish"s, DocumentStatus::ACTUAL, { 1 });
+    for (const string& query : { "+cat dog"s, "+cat +dog"s, "+dog -bird"s, "+fish cat"s }) {
+        const vector<Document> exact = search_server.FindTopDocuments(query);
+        const vector<Document> parallel = search_server.FindTopDocuments(execution::par, query);
+        const SearchResult within = search_server.FindTopDocumentsWithin(query, {});
+        assert(!within.is_approximate);
+        assert(exact.size() == within.documents.size() && parallel.size() == within.documents.size());
+        for (size_t i = 0; i < exact.size(); ++i) {
+            assert(exact[i].id == within.documents[i].id && parallel[i].id == within.documents[i].id);
+        }
+    }
+    assert(search_server.FindTopDocumentsWithin("+cat dog"s, {}).documents.size() == 1);
+    assert(search_server.FindTopDocumentsWithin("+mouse dog"s, {}).documents.empty());
+}
+vector<string> GetPlannedWords(const vector<PlannedWord>& planned_words) {
+    vector<string> words;
+    for (const PlannedWord& planned_word : planned_words) {
+        words.push_back(planned_word.word);
+    }
+    return words;
+}
+// The plan evaluates the rarest words first, prunes common optional words and gives up on a missing required one
+void TestExplainQuery() {
+    SearchServer search_server("and"s);
+    const vector<string> documents = { "cat dog bird"s, "cat dog"s, "cat dog"s, "cat fish"s, "cat"s, "cat and dog"s, "cat"s, "dog"s };
+    for (size_t i = 0; i < documents.size(); ++i) {
+        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1 });
+    }
+
+    QueryExplanation explanation = search_server.ExplainQuery("cat and dog bird -fish"s);
+    assert((GetPlannedWords(explanation.plus_words) == vector<string>{ "bird"s, "dog"s, "cat"s }));
+    assert(explanation.plus_words[0].document_count == 1 && explanation.plus_words[1].document_count == 5 && explanation.plus_words[2].document_count == 7);
+    assert(abs(explanation.plus_words[0].inverse_document_freq - log(8.0)) < 1e-9);
+    assert((GetPlannedWords(explanation.minus_words) == vector<string>{ "fish"s }));
+    assert(explanation.pruned_words.empty() && explanation.missing_words.empty() && !explanation.is_empty);
+    assert(explanation.estimated_cost == 1 + 5 + 7 + 1);
+    explanation = search_server.ExplainQuery("+cat +bird dog"s);
+    assert((GetPlannedWords(explanation.plus_words) == vector<string>{ "bird"s, "dog"s, "cat"s }));
+    // Every candidate of the rarest required word is probed in the other required list
+    assert(explanation.estimated_cost == 1 * 2);
+
+    // ln(8/7) of "cat" is below the threshold, ln(8/5) of "dog" is above it
+    search_server.SetMinInverseDocumentFreq(0.3);
+    explanation = search_server.ExplainQuery("cat dog bird"s);
+    assert((GetPlannedWords(explanation.plus_words) == vector<string>{ "bird"s, "dog"s }));
+    assert((GetPlannedWords(explanation.pruned_words) == vector<string>{ "cat"s }));
+    for (const Document& document : search_server.FindTopDocuments("cat dog bird"s)) {
+        assert(documents[document.id].find("dog"s) != string::npos || documents[document.id].find("bird"s) != string::npos);
+    }
+    explanation = search_server.ExplainQuery("+cat dog bird"s);
+    assert((GetPlannedWords(explanation.plus_words) == vector<string>{ "bird"s, "dog"s, "cat"s }));
+    assert(explanation.pruned_words.empty() && explanation.plus_words[2].is_required);
+    // The rarest word is evaluated whatever its IDF
+    explanation = search_server.ExplainQuery("cat"s);
+    assert((GetPlannedWords(explanation.plus_words) == vector<string>{ "cat"s }) && explanation.pruned_words.empty());
+    search_server.SetMinInverseDocumentFreq(0);
+
+    explanation = search_server.ExplainQuery("unicorn cat"s);
+    assert((explanation.missing_words == vector<string>{ "unicorn"s }) && !explanation.is_empty);
+    explanation = search_server.ExplainQuery("+unicorn cat -dog"s);
+    assert((explanation.missing_words == vector<string>{ "unicorn"s }) && explanation.is_empty);
+    assert(explanation.minus_words.empty() && explanation.estimated_cost == 0);
+    assert(search_server.FindTopDocuments("+unicorn cat"s).empty());
+    assert(search_server.FindTopDocuments("+unicorn cat"s, QueryMode::ALL).empty());
+}
+// Words of removed documents must not use up the prefix expansion limit,
+// both in the built dictionary and among words added after it
+void TestPrefixAfterRemoval() {
+    SearchServer search_server(""s);
+    const int removed_count = 1100;
+    for (int id = 0; id < removed_count; ++id) {
+        search_server.AddDocument(id, "aaa"s + to_string(id), DocumentStatus::ACTUAL, { 1 });
+    }
+    for (int id = 0; id < removed_count; ++id) {
+        search_server.RemoveDocument(id);
+    }
+    search_server.AddDocument(removed_count, "aazz"s, DocumentStatus::ACTUAL, { 1 });
+    assert(search_server.FindTopDocuments("aazz"s).size() == 1);
+    assert(search_server.FindTopDocuments("aa*"s).size() == 1);
+    assert(search_server.FindTopDocuments("aa*"s, QueryMode::ALL).size() == 1);
+}
+// Matching through the forward index: plus and minus words, status, removed ids and the batch call
+void TestMatchDocument() {
+    SearchServer search_server("and"s);
+    search_server.AddDocument(1, "white cat and fluffy tail"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(2, "fluffy dog"s, DocumentStatus::BANNED, { 2 });
+    search_server.AddDocument(3, "white dog and white cat"s, DocumentStatus::IRRELEVANT, { 3 });
+    search_server.AddDocument(4, "parrot"s, DocumentStatus::ACTUAL, { 4 });
+    search_server.RemoveDocument(4);
+
+    const auto [words, status] = search_server.MatchDocument("fluffy white cat and parrot"s, 1);
+    assert((words == vector<string_view>{ "cat"sv, "fluffy"sv, "white"sv }) && status == DocumentStatus::ACTUAL);
+    assert(get<0>(search_server.MatchDocument("cat -dog"s, 3)).empty());
+    assert(get<1>(search_server.MatchDocument("cat -dog"s, 3)) == DocumentStatus::IRRELEVANT);
+    assert(get<1>(search_server.MatchDocument(execution::par, "fluffy"s, 2)) == DocumentStatus::BANNED);
+    assert(get<0>(search_server.MatchDocument("parrot"s, 1)).empty());
+
+    bool thrown = false;
+    try {
+        search_server.MatchDocument("parrot"s, 4);
+    }
+    catch (const out_of_range&) {
+        thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+        search_server.MatchDocuments("parrot"sv, { 1, 4 });
+    }
+    catch (const out_of_range&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    const vector<int> ids = { 3, 1, 2, 1 };
+    for (const string& query : { "white cat"s, "fluffy -cat"s, "dog -tail white"s, "missing"s }) {
+        const vector<SearchServer::MatchResult> batch = search_server.MatchDocuments(query, ids);
+        assert(batch.size() == ids.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+            assert(batch[i] == search_server.MatchDocument(query, ids[i]));
+            assert(batch[i] == search_server.MatchDocument(execution::seq, query, ids[i]));
+            assert(batch[i] == search_server.MatchDocument(execution::par, query, ids[i]));
+        }
+    }
+}
+// ALL mode gives the ANY mode results of the documents that have every plus word,
+// with minus words, repeated words and stop words in the query
+void TestQueryModeAll() {
+    mt19937 generator(3);
+    const auto dictionary = GenerateDictionary(generator, 30, 4);
+    const string stop_word = dictionary[0];
+    SearchServer search_server(stop_word);
+    for (int id = 0; id < 2'000; ++id) {
+        search_server.AddDocument(id, GenerateQuery(generator, dictionary, 10), DocumentStatus::ACTUAL, { id % 7 });
+    }
+    vector<string> queries;
+    for (int i = 0; i < 300; ++i) {
+        string query = GenerateQuery(generator, dictionary, 3, 0.3);
+        // Repeats the first word, plus or minus
+        query += ' ' + query.substr(0, query.find(' '));
+        queries.push_back(move(query));
+    }
+    queries.push_back(stop_word + ' ' + dictionary[1]);
+    queries.push_back(dictionary[1] + " -"s + dictionary[1]);
+    size_t found_count = 0;
+    for (const string& query : queries) {
+        set<string_view> plus_words;
+        for (const string_view word : SplitIntoWordsView(query)) {
+            if (word[0] != '-' && word != stop_word) {
+                plus_words.insert(word);
+            }
+        }
+        const auto has_plus_words = [&](int document_id, DocumentStatus, int) {
+            const auto& word_freqs = search_server.GetWordFrequencies(document_id);
+            return all_of(plus_words.begin(), plus_words.end(), [&](string_view word) { return word_freqs.count(word) > 0; });
+        };
+        const vector<Document> expected = search_server.FindTopDocuments(query, QueryMode::ANY, has_plus_words);
+        const vector<Document> actual = search_server.FindTopDocuments(query, QueryMode::ALL);
+        assert(actual.size() == expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            assert(actual[i].id == expected[i].id && actual[i].rating == expected[i].rating);
+            assert(abs(actual[i].relevance - expected[i].relevance) < 1e-9);
+        }
+        found_count += actual.size();
+    }
+    // The queries are short enough for ALL mode to find something
+    assert(found_count > 0);
+    assert(search_server.FindTopDocuments(dictionary[1] + " -"s + dictionary[1], QueryMode::ALL).empty());
+}
+// Brute force over the live documents, ordered like SelectTopDocuments
+vector<Document> FindReferenceTopDocuments(const map<int, vector<string>>& documents, string_view raw_query) {
+    set<string, less<>> plus_words;
+    set<string, less<>> minus_words;
+    for (const string_view word : SplitIntoWordsView(raw_query)) {
+        if (word[0] == '-') {
+            minus_words.emplace(word.substr(1));
+        }
+        else {
+            plus_words.emplace(word);
+        }
+    }
+    map<string_view, int> document_counts;
+    for (const auto& [id, words] : documents) {
+        for (const string_view word : set<string_view>(words.begin(), words.end())) {
+            ++document_counts[word];
+        }
+    }
+    vector<Document> result;
+    for (const auto& [id, words] : documents) {
+        if (any_of(words.begin(), words.end(), [&](const string& word) { return minus_words.count(word) > 0; })) {
+            continue;
+        }
+        double relevance = 0;
+        bool matched = false;
+        for (const string& word : plus_words) {
+            const auto word_count = count(words.begin(), words.end(), word);
+            if (word_count > 0) {
+                matched = true;
+                relevance += log(documents.size() * 1.0 / document_counts[word]) * word_count / words.size();
+            }
+        }
+        if (matched) {
+            result.emplace_back(id, relevance, id);
+        }
+    }
+    sort(result.begin(), result.end(), [](const Document& lhs, const Document& rhs) {
+        return abs(lhs.relevance - rhs.relevance) < DELTA ? lhs.rating > rhs.rating : lhs.relevance > rhs.relevance;
+    });
+    result.resize(min<size_t>(result.size(), MAX_RESULT_DOCUMENT_COUNT));
+    return result;
+}
+void AssertSameAsReference(const SearchServer& search_server, const map<int, vector<string>>& documents, const vector<string>& queries) {
+    assert(search_server.GetDocumentCount() == static_cast<int>(documents.size()));
+    for (const string& query : queries) {
+        const vector<Document> expected = FindReferenceTopDocuments(documents, query);
+        const vector<Document> actual = search_server.FindTopDocuments(query);
+        const vector<Document> parallel = search_server.FindTopDocuments(execution::par, query);
+        assert(actual.size() == expected.size() && parallel.size() == expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            assert(actual[i].id == expected[i].id && parallel[i].id == expected[i].id);
+            assert(abs(actual[i].relevance - expected[i].relevance) < 1e-9);
+        }
+    }
+}
+// Enough documents for several frozen segments: removals from frozen segments, their tombstones dropped
+// by merging, ids added again while the old version sits in a frozen segment. Ratings are the ids,
+// so every document has its own place among equally relevant ones
+void TestSegments() {
+    mt19937 generator(2);
+    const auto dictionary = GenerateDictionary(generator, 300, 6);
+    const auto queries = GenerateQueries(generator, dictionary, 200, 3);
+    const auto minus_queries = [&] {
+        vector<string> result;
+        for (int i = 0; i < 50; ++i) {
+            result.push_back(GenerateQuery(generator, dictionary, 4, 0.3));
+        }
+        return result;
+    }();
+    SearchServer search_server(""s);
+    map<int, vector<string>> documents;
+    const auto add_document = [&](int id) {
+        const string text = GenerateQuery(generator, dictionary, 8);
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id });
+        documents[id].clear();
+        for (const string_view word : SplitIntoWordsView(text)) {
+            documents[id].emplace_back(word);
+        }
+    };
+    // A flat time per batch means adding a document doesn't get slower as the index grows
+    vector<long long> batch_durations;
+    const auto add_batch = [&] {
+        const int first_id = batch_durations.size() * MUTABLE_SEGMENT_DOCUMENT_COUNT;
+        const auto start = chrono::steady_clock::now();
+        for (int id = first_id; id < first_id + MUTABLE_SEGMENT_DOCUMENT_COUNT; ++id) {
+            add_document(id);
+        }
+        batch_durations.push_back(chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count());
+    };
+    // Removes every third of the documents added so far and adds every ninth again with another text
+    const auto remove_and_add_again = [&](int first_id) {
+        const int end_id = batch_durations.size() * MUTABLE_SEGMENT_DOCUMENT_COUNT;
+        for (int id = first_id; id < end_id; id += 3) {
+            search_server.RemoveDocument(id);
+            documents.erase(id);
+        }
+        for (int id = first_id; id < end_id; id += 9) {
+            add_document(id);
+        }
+    };
+    // Three frozen segments, fewer than SEGMENT_MERGE_FACTOR, so the removals stay tombstones
+    for (int batch = 0; batch < 3; ++batch) {
+        add_batch();
+    }
+    remove_and_add_again(0);
+    for (const auto& checked_queries : { queries, minus_queries }) {
+        AssertSameAsReference(search_server, documents, checked_queries);
+    }
+    // The next frozen segments get the first ones merged with their tombstones dropped
+    for (int batch = 3; batch < 6; ++batch) {
+        add_batch();
+    }
+    remove_and_add_again(3 * MUTABLE_SEGMENT_DOCUMENT_COUNT);
+    for (const auto& checked_queries : { queries, minus_queries }) {
+        AssertSameAsReference(search_server, documents, checked_queries);
+    }
+    search_server.WaitForSegmentMerges();
+    for (const auto& checked_queries : { queries, minus_queries }) {
+        AssertSameAsReference(search_server, documents, checked_queries);
+    }
+    cout << "ingestion, ms per "s << MUTABLE_SEGMENT_DOCUMENT_COUNT << " documents:"s;
+    for (const long long duration : batch_durations) {
+        cout << ' ' << duration;
+    }
+    cout << endl;
+}
+// Large enough for ParseCorpus to split the data into chunks, line lengths vary so the chunk borders fall inside lines.
+// Lines end with LF or CRLF, the last one has no line end
+string MakeCorpus(mt19937& generator, const vector<string>& dictionary, int document_count, vector<DocumentRecord>& records, vector<string>& texts) {
+    const array<string, 4> statuses = { "ACTUAL"s, "IRRELEVANT"s, "BANNED"s, "REMOVED"s };
+    string corpus;
+    texts.resize(document_count);
+    for (int id = 0; id < document_count; ++id) {
+        texts[id] = GenerateQuery(generator, dictionary, uniform_int_distribution(1, 60)(generator));
+        const vector<int> ratings = { id % 11 - 5, id % 3 };
+        corpus += to_string(id) + '\t' + statuses[id % 4] + '\t' + to_string(ratings[0]) + ' ' + to_string(ratings[1]) + '\t' + texts[id];
+        if (id + 1 < document_count) {
+            corpus += id % 2 ? "\r\n"s : "\n"s;
+        }
+        if (id % 1000 == 0) {
+            corpus += '\n';
+        }
+        records.push_back({ id, static_cast<DocumentStatus>(id % 4), ratings, {} });
+    }
+    for (int id = 0; id < document_count; ++id) {
+        records[id].text = texts[id];
+    }
+    return corpus;
+}
+void TestParseCorpus(const vector<string>& dictionary) {
+    mt19937 generator(4);
+    vector<DocumentRecord> expected;
+    vector<string> texts;
+    const string corpus = MakeCorpus(generator, dictionary, 30'000, expected, texts);
+    assert(corpus.size() > (4 << 20) && corpus.back() != '\n');
+    const vector<DocumentRecord> records = ParseCorpus(corpus);
+    assert(records.size() == expected.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        assert(records[i].id == expected[i].id && records[i].status == expected[i].status);
+        assert(records[i].ratings == expected[i].ratings && records[i].text == expected[i].text);
+    }
+    assert(ParseCorpus("7\tBANNED\t\tcat dog"sv).size() == 1);
+    assert(ParseCorpus(""sv).empty() && ParseCorpus("\n\r\n"sv).empty());
+
+    // A malformed line is reported wherever it is, also far from the first chunk
+    const string malformed_middle = corpus.substr(0, corpus.size() / 2) + "\n1\tACTUAL\tx\tcat\n"s + corpus.substr(corpus.size() / 2);
+    for (const string& malformed : { "x\tACTUAL\t1\tcat"s, "1\tNEW\t1\tcat"s, "1\tACTUAL\t1 2x\tcat"s, "1\tactual\t1\tcat"s, malformed_middle }) {
+        bool thrown = false;
+        try {
+            ParseCorpus(malformed);
+        }
+        catch (const invalid_argument&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+// Every shard gets the documents GetDocumentShard assigns to it, together they have the whole corpus
+void TestLoadCorpus(const vector<string>& dictionary) {
+    mt19937 generator(5);
+    vector<DocumentRecord> expected;
+    vector<string> texts;
+    const string corpus = MakeCorpus(generator, dictionary, 3'000, expected, texts);
+    const string path = (filesystem::temp_directory_path() / "search_server_corpus.txt"s).string();
+    ofstream(path, ios::binary) << corpus;
+
+    SearchServer whole(""s);
+    assert(LoadCorpus(whole, path) == expected.size());
+    const int shard_count = 3;
+    size_t loaded_count = 0;
+    for (int shard = 0; shard < shard_count; ++shard) {
+        SearchServer search_server(""s);
+        loaded_count += LoadCorpus(search_server, path, shard, shard_count);
+        for (const DocumentRecord& record : expected) {
+            assert(search_server.DocumeentExist(record.id) == (GetDocumentShard(record.id, shard_count) == shard));
+        }
+        for (const int document_id : search_server) {
+            assert(search_server.GetDocumentText(document_id) == expected[document_id].text);
+            assert(search_server.GetDocumentStatus(document_id) == expected[document_id].status);
+        }
+    }
+    filesystem::remove(path);
+    assert(loaded_count == expected.size());
+    for (const DocumentRecord& record : expected) {
+        assert(whole.GetDocumentText(record.id) == record.text);
+    }
+}
+string MakeTempLogPath(string_view name) {
+    const string path = (filesystem::temp_directory_path() / ("search_server_"s + string(name) + ".wal"s)).string();
+    filesystem::remove(path);
+    return path;
+}
+void AssertSameDocuments(const SearchServer& expected, const SearchServer& actual, const vector<string>& queries) {
+    assert(expected.GetDocumentCount() == actual.GetDocumentCount());
+    for (const int document_id : expected) {
+        assert(actual.GetDocumentStatus(document_id) == expected.GetDocumentStatus(document_id));
+        assert(actual.GetDocumentRating(document_id) == expected.GetDocumentRating(document_id));
+    }
+    for (const string& query : queries) {
+        const auto expected_documents = expected.FindTopDocuments(query);
+        const auto actual_documents = actual.FindTopDocuments(query);
+        assert(expected_documents.size() == actual_documents.size());
+        for (size_t i = 0; i < expected_documents.size(); ++i) {
+            assert(actual_documents[i].id == expected_documents[i].id);
+            assert(abs(actual_documents[i].relevance - expected_documents[i].relevance) < 1e-9);
+        }
+    }
+}
+// Adds, removals and re-adds of the same id come back from the log
+void TestWriteAheadLogRecovery(const vector<string>& dictionary, const vector<string>& documents, const vector<string>& queries) {
+    const string path = MakeTempLogPath("recovery"sv);
+    SearchServer expected(dictionary[0]);
+    {
+        WriteAheadLog log(path);
+        expected.SetWriteAheadLog(&log);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            expected.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { static_cast<int>(i % 5), 3 });
+        }
+        for (size_t i = 0; i < documents.size(); i += 3) {
+            expected.RemoveDocument(i);
+        }
+        expected.AddDocument(3, dictionary[1] + " "s + dictionary[2], DocumentStatus::BANNED, { 7 });
+        expected.SetWriteAheadLog(nullptr);
+    }
+    WriteAheadLog log(path);
+    SearchServer recovered(dictionary[0]);
+    assert(log.Recover(recovered) == static_cast<size_t>(expected.GetDocumentCount()));
+    AssertSameDocuments(expected, recovered, queries);
+    filesystem::remove(path);
+}
+// A torn last record and a record with a wrong checksum are cut off, appends continue after the intact part
+void TestWriteAheadLogTornTail() {
+    const string path = MakeTempLogPath("torn"sv);
+    uintmax_t intact_size = 0;
+    {
+        WriteAheadLog log(path);
+        SearchServer search_server(""s);
+        search_server.SetWriteAheadLog(&log);
+        for (int id = 0; id < 10; ++id) {
+            if (id == 9) {
+                log.Commit();
+                intact_size = filesystem::file_size(path);
+            }
+            search_server.AddDocument(id, "cat dog "s + to_string(id), DocumentStatus::ACTUAL, { id });
+        }
+        search_server.SetWriteAheadLog(nullptr);
+    }
+    filesystem::resize_file(path, filesystem::file_size(path) - 3);
+    {
+        WriteAheadLog log(path);
+        SearchServer search_server(""s);
+        assert(log.Recover(search_server) == 9);
+        assert(filesystem::file_size(path) == intact_size);
+    }
+    {
+        ofstream out(path, ios::binary | ios::app);
+        const uint32_t size = 5;
+        const uint32_t wrong_checksum = 0;
+        out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        out.write(reinterpret_cast<const char*>(&wrong_checksum), sizeof(wrong_checksum));
+        out << "hello"s;
+    }
+    {
+        WriteAheadLog log(path);
+        SearchServer search_server(""s);
+        assert(log.Recover(search_server) == 9);
+        assert(filesystem::file_size(path) == intact_size);
+        search_server.SetWriteAheadLog(&log);
+        search_server.AddDocument(9, "cat bird"s, DocumentStatus::ACTUAL, { 1 });
+        search_server.SetWriteAheadLog(nullptr);
+    }
+    WriteAheadLog log(path);
+    SearchServer search_server(""s);
+    assert(log.Recover(search_server) == 10);
+    assert(search_server.FindTopDocuments("bird"s).size() == 1);
+    filesystem::remove(path);
+}
+// A checkpoint replaces the history with the live documents, later records are appended to it
+void TestWriteAheadLogCheckpoint(const vector<string>& dictionary, const vector<string>& documents, const vector<string>& queries) {
+    const string path = MakeTempLogPath("checkpoint"sv);
+    SearchServer expected(dictionary[0]);
+    {
+        WriteAheadLog log(path);
+        expected.SetWriteAheadLog(&log);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            expected.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+        for (size_t i = 0; i < documents.size(); i += 10) {
+            expected.RemoveDocument(i + 1);
+            expected.RemoveDocument(i + 2);
+            expected.RemoveDocument(i + 3);
+        }
+        log.Commit();
+        const uintmax_t size_before = filesystem::file_size(path);
+        log.Checkpoint(expected);
+        assert(filesystem::file_size(path) < size_before);
+        assert(!filesystem::exists(path + ".checkpoint"s));
+        expected.RemoveDocument(0);
+        expected.AddDocument(1, dictionary[1], DocumentStatus::IRRELEVANT, { 5 });
+        expected.SetWriteAheadLog(nullptr);
+    }
+    WriteAheadLog log(path);
+    SearchServer recovered(dictionary[0]);
+    assert(log.Recover(recovered) == static_cast<size_t>(expected.GetDocumentCount()));
+    AssertSameDocuments(expected, recovered, queries);
+    filesystem::remove(path);
+}
+// Records reach the disk on Commit, or once the first of a group waited max_group_delay even if no more come.
+// Changes rejected by the server are not logged
+void TestWriteAheadLogGroupFlush() {
+    const string path = MakeTempLogPath("group"sv);
+    const string reference_path = MakeTempLogPath("group_reference"sv);
+    {
+        WriteAheadLog log(path, DurabilityLevel::GROUP, 256, chrono::hours(1));
+        SearchServer search_server(""s);
+        search_server.SetWriteAheadLog(&log);
+        search_server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, { 1 });
+        search_server.AddDocument(2, "dog"s, DocumentStatus::ACTUAL, { 2 });
+        for (const auto& [id, text] : { pair{ 2, "bird"s }, pair{ 3, "bad\x01"s } }) {
+            try {
+                search_server.AddDocument(id, text, DocumentStatus::ACTUAL, { 3 });
+                assert(false);
+            }
+            catch (const invalid_argument&) {
+            }
+        }
+        search_server.RemoveDocument(4);
+        assert(filesystem::file_size(path) == 0);
+        log.Commit();
+        WriteAheadLog reader(path);
+        SearchServer recovered(""s);
+        assert(reader.Recover(recovered) == 2);
+        assert(recovered.FindTopDocuments("dog"s).size() == 1 && recovered.FindTopDocuments("bird"s).empty());
+        search_server.SetWriteAheadLog(nullptr);
+    }
+    filesystem::remove(path);
+    {
+        WriteAheadLog reference(reference_path, DurabilityLevel::FULL);
+        reference.LogAddDocument(1, "cat"sv, DocumentStatus::ACTUAL, { 1 });
+        reference.LogAddDocument(2, "dog"sv, DocumentStatus::ACTUAL, { 2 });
+    }
+    {
+        WriteAheadLog log(path, DurabilityLevel::GROUP, 256, chrono::milliseconds(10));
+        SearchServer search_server(""s);
+        search_server.SetWriteAheadLog(&log);
+        search_server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, { 1 });
+        search_server.AddDocument(2, "dog"s, DocumentStatus::ACTUAL, { 2 });
+        // The deadline only bounds the wait on a stalled machine
+        const auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+        while (filesystem::file_size(path) < filesystem::file_size(reference_path) && chrono::steady_clock::now() < deadline) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        assert(filesystem::file_size(path) == filesystem::file_size(reference_path));
+        WriteAheadLog reader(path);
+        SearchServer recovered(""s);
+        assert(reader.Recover(recovered) == 2);
+        search_server.SetWriteAheadLog(nullptr);
+    }
+    filesystem::remove(path);
+    filesystem::remove(reference_path);
+}
+// How much group commit slows ingestion down compared to the server without a log
+void TestGroupCommitThroughput(const vector<string>& dictionary, const vector<string>& documents) {
+    const string path = MakeTempLogPath("throughput"sv);
+    auto add_documents = [&](WriteAheadLog* log) {
+        const auto start = chrono::steady_clock::now();
+        SearchServer search_server(dictionary[0]);
+        search_server.SetWriteAheadLog(log);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+        if (log) log->Commit();
+        search_server.SetWriteAheadLog(nullptr);
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+    const double in_memory = add_documents(nullptr);
+    double with_log = 0;
+    {
+        WriteAheadLog log(path, DurabilityLevel::GROUP);
+        with_log = add_documents(&log);
+    }
+    cout << "write-ahead log ingestion slowdown "s << with_log / in_memory << endl;
+    filesystem::remove(path);
+}
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
 int main() {
+    TestMatchDocument();
+    TestPrefixAfterRemoval();
+    TestRequiredWordsWithin();
+    TestExplainQuery();
+    TestSegments();
+    TestQueryModeAll();
     mt19937 generator;
     const auto dictionary = GenerateDictionary(generator, 1000, 10);
+    TestParseCorpus(dictionary);
+    TestLoadCorpus(dictionary);
     const auto documents = GenerateQueries(generator, dictionary, 10'000, 70);
     SearchServer search_server(dictionary[0]);
+    search_server.SetImpactOrderedPostings(true);
     for (size_t i = 0; i < documents.size(); ++i) {
         search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
     }
+    const vector<string> log_documents(documents.begin(), documents.begin() + 3'000);
+    mt19937 log_generator(1);
+    const auto log_queries = GenerateQueries(log_generator, dictionary, 100, 3);
+    TestWriteAheadLogRecovery(dictionary, log_documents, log_queries);
+    TestWriteAheadLogTornTail();
+    TestWriteAheadLogCheckpoint(dictionary, log_documents, log_queries);
+    TestWriteAheadLogGroupFlush();
+    TestGroupCommitThroughput(dictionary, log_documents);
     const auto queries = GenerateQueries(generator, dictionary, 100, 70);
     TEST(seq);
     TEST(par);
+    const auto short_queries = GenerateQueries(generator, dictionary, 100, 3);
+    TestQueryMode("ANY"s, search_server, short_queries, QueryMode::ANY);
+    TestQueryMode("ALL"s, search_server, short_queries, QueryMode::ALL);
+    for (size_t posting_count : { size_t{ 1'000 }, size_t{ 10'000 }, size_t{ 100'000 }, numeric_limits<size_t>::max() }) {
+        TestBudget(search_server, short_queries, posting_count);
+    }
+    TestQueryArenaReuse(search_server, short_queries);
+    cout << search_server.ExplainQuery(short_queries[0]);
+    search_server.SetMinInverseDocumentFreq(1.5);
+    cout << search_server.ExplainQuery(short_queries[0]);
+    TestQueryMode("ANY pruned"s, search_server, short_queries, QueryMode::ANY);
+    const AllocatorStatistics statistics = search_server.GetAllocatorStatistics();
+    cout << "index nodes: "s << statistics.index_nodes.allocation_count << " allocations, "s << statistics.index_nodes.bytes_in_use << " bytes"s << endl;
+    cout << "index chunks: "s << statistics.index_upstream.allocation_count << " allocations, "s << statistics.index_upstream.bytes_in_use << " bytes"s << endl;
+    cout << "query arenas: "s << statistics.query_heap.allocation_count << " allocations, peak "s << statistics.query_heap.peak_bytes_in_use << " bytes"s << endl;
+    // Before the dictionary became the only copy, every word also took a std::string of its own
+    cout << "word dictionary: "s << statistics.word_count << " words, "s << statistics.word_dictionary_bytes << " bytes (at least "s
+        << statistics.word_dictionary_bytes + statistics.word_count * sizeof(string) << " with a std::string per word)"s << endl;
 }
\ No newline at end of file
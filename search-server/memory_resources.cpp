@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <optional>
+
+#include "memory_resources.h"
+
+namespace {
+const size_t INITIAL_ARENA_SIZE = 16 << 10;
+const size_t MAX_ARENA_SIZE = 64 << 20;
+
+CountingResource& GetArenaHeap() {
+    static CountingResource heap(std::pmr::new_delete_resource());
+    return heap;
+}
+
+class ThreadArena {
+public:
+    ThreadArena()
+        : overflow_(&GetArenaHeap()) {
+        Allocate(INITIAL_ARENA_SIZE);
+    }
+
+    ~ThreadArena() {
+        resource_.reset();
+        GetArenaHeap().deallocate(buffer_, buffer_size_);
+    }
+
+    std::pmr::memory_resource* GetResource() {
+        return &*resource_;
+    }
+
+    // Frees everything allocated since the last release, a buffer that was too small grows by the overflow
+    void Release() {
+        const size_t overflow = overflow_.GetStatistics().bytes_in_use;
+        if (overflow == 0 || buffer_size_ >= MAX_ARENA_SIZE) {
+            resource_->release();
+            return;
+        }
+        resource_.reset();
+        GetArenaHeap().deallocate(buffer_, buffer_size_);
+        Allocate(std::min(MAX_ARENA_SIZE, buffer_size_ + overflow));
+    }
+
+private:
+    // Chunks taken when the buffer is exhausted
+    CountingResource overflow_;
+    void* buffer_ = nullptr;
+    size_t buffer_size_ = 0;
+    std::optional<std::pmr::monotonic_buffer_resource> resource_;
+
+    void Allocate(size_t size) {
+        buffer_size_ = size;
+        buffer_ = GetArenaHeap().allocate(buffer_size_);
+        resource_.emplace(buffer_, buffer_size_, &overflow_);
+    }
+};
+
+thread_local int arena_depth = 0;
+
+ThreadArena& GetThreadArena() {
+    thread_local ThreadArena arena;
+    return arena;
+}
+}
+
+CountingResource::CountingResource(std::pmr::memory_resource* upstream)
+    : upstream_(upstream) {}
+
+AllocationStatistics CountingResource::GetStatistics() const {
+    return {
+        allocation_count_.load(std::memory_order_relaxed),
+        deallocation_count_.load(std::memory_order_relaxed),
+        bytes_in_use_.load(std::memory_order_relaxed),
+        peak_bytes_in_use_.load(std::memory_order_relaxed),
+    };
+}
+
+void* CountingResource::do_allocate(size_t bytes, size_t alignment) {
+    void* result = upstream_->allocate(bytes, alignment);
+    allocation_count_.fetch_add(1, std::memory_order_relaxed);
+    const size_t bytes_in_use = bytes_in_use_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = peak_bytes_in_use_.load(std::memory_order_relaxed);
+    while (peak < bytes_in_use && !peak_bytes_in_use_.compare_exchange_weak(peak, bytes_in_use, std::memory_order_relaxed)) {}
+    return result;
+}
+
+void CountingResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    upstream_->deallocate(p, bytes, alignment);
+    deallocation_count_.fetch_add(1, std::memory_order_relaxed);
+    bytes_in_use_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+bool CountingResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+PoolMemory::PoolMemory(std::pmr::memory_resource* upstream)
+    : upstream_(upstream)
+    , pool_(&upstream_)
+    , nodes_(&pool_) {}
+
+std::pmr::memory_resource* PoolMemory::GetResource() {
+    return &nodes_;
+}
+
+AllocationStatistics PoolMemory::GetNodeStatistics() const {
+    return nodes_.GetStatistics();
+}
+
+AllocationStatistics PoolMemory::GetUpstreamStatistics() const {
+    return upstream_.GetStatistics();
+}
+
+QueryArena::QueryArena() {
+    ++arena_depth;
+}
+
+QueryArena::~QueryArena() {
+    if (--arena_depth == 0) GetThreadArena().Release();
+}
+
+std::pmr::memory_resource* QueryArena::GetResource() {
+    return arena_depth > 0 ? GetThreadArena().GetResource() : std::pmr::get_default_resource();
+}
+
+AllocationStatistics QueryArena::GetStatistics() {
+    return GetArenaHeap().GetStatistics();
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+
+struct AllocationStatistics {
+    size_t allocation_count = 0;
+    size_t deallocation_count = 0;
+    size_t bytes_in_use = 0;
+    size_t peak_bytes_in_use = 0;
+};
+
+// Passes requests to the upstream resource and counts them, thread safe
+class CountingResource : public std::pmr::memory_resource {
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream);
+
+    AllocationStatistics GetStatistics() const;
+
+private:
+    std::pmr::memory_resource* const upstream_;
+    std::atomic<size_t> allocation_count_ = 0;
+    std::atomic<size_t> deallocation_count_ = 0;
+    std::atomic<size_t> bytes_in_use_ = 0;
+    std::atomic<size_t> peak_bytes_in_use_ = 0;
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+// Pool of the index containers: nodes are carved from large chunks and reused after removals
+class PoolMemory {
+public:
+    explicit PoolMemory(std::pmr::memory_resource* upstream);
+
+    std::pmr::memory_resource* GetResource();
+    // Requests of the containers
+    AllocationStatistics GetNodeStatistics() const;
+    // Chunks the pool took from upstream
+    AllocationStatistics GetUpstreamStatistics() const;
+
+private:
+    CountingResource upstream_;
+    std::pmr::synchronized_pool_resource pool_;
+    CountingResource nodes_;
+};
+
+// Scope of one query on the current thread. Containers created from GetResource() inside the scope
+// come from a monotonic arena of the thread that is released when the outermost scope ends,
+// so they must not outlive it. The arena buffer grows to the largest query seen,
+// after that queries don't allocate from the heap
+class QueryArena {
+public:
+    QueryArena();
+    ~QueryArena();
+    QueryArena(const QueryArena&) = delete;
+    QueryArena& operator=(const QueryArena&) = delete;
+
+    // Arena of the current thread, the default resource outside of any scope
+    static std::pmr::memory_resource* GetResource();
+    // Heap memory taken by the arenas of all threads
+    static AllocationStatistics GetStatistics();
+};
@@ -0,0 +1,93 @@
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "posting_intersection.h"
+
+// Beyond this size ratio galloping skips enough of the larger array to beat block comparison
+const size_t GALLOPING_SIZE_RATIO = 32;
+
+void IntersectGalloping(const int* small, size_t small_size, const int* large, size_t large_size, std::vector<IntersectionMatch>& matches) {
+    const int* it = large;
+    const int* const end = large + large_size;
+    for (size_t i = 0; i < small_size; ++i) {
+        const int id = small[i];
+        // Double the step while the probe is below the id, then bisect the last step
+        const int* low = it;
+        size_t step = 1;
+        while (static_cast<size_t>(end - low) > step && *(low + step) < id) {
+            low += step;
+            step *= 2;
+        }
+        const int* high = static_cast<size_t>(end - low) > step ? low + step + 1 : end;
+        it = std::lower_bound(low, high, id);
+        if (it == end) break;
+        if (*it == id) {
+            matches.emplace_back(i, static_cast<size_t>(it - large));
+            ++it;
+        }
+    }
+}
+
+void IntersectBlocks(const int* lhs, size_t lhs_size, const int* rhs, size_t rhs_size, std::vector<IntersectionMatch>& matches) {
+    size_t i = 0;
+    size_t j = 0;
+#ifdef __SSE2__
+    while (i + 4 <= lhs_size && j + 4 <= rhs_size) {
+        const __m128i lhs_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i));
+        const __m128i rhs_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + j));
+        // Lane k of rotation r holds rhs[j + (k + r) % 4]
+        const __m128i rotations[4] = {
+            rhs_block,
+            _mm_shuffle_epi32(rhs_block, _MM_SHUFFLE(0, 3, 2, 1)),
+            _mm_shuffle_epi32(rhs_block, _MM_SHUFFLE(1, 0, 3, 2)),
+            _mm_shuffle_epi32(rhs_block, _MM_SHUFFLE(2, 1, 0, 3)),
+        };
+        int rhs_lane[4] = { -1, -1, -1, -1 };
+        for (int r = 0; r < 4; ++r) {
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lhs_block, rotations[r])));
+            while (mask != 0) {
+                const int lane = __builtin_ctz(mask);
+                rhs_lane[lane] = (lane + r) % 4;
+                mask &= mask - 1;
+            }
+        }
+        for (int lane = 0; lane < 4; ++lane) {
+            if (rhs_lane[lane] >= 0) matches.emplace_back(i + lane, j + rhs_lane[lane]);
+        }
+        const int lhs_max = lhs[i + 3];
+        const int rhs_max = rhs[j + 3];
+        if (lhs_max <= rhs_max) i += 4;
+        if (rhs_max <= lhs_max) j += 4;
+    }
+#endif
+    while (i < lhs_size && j < rhs_size) {
+        if (lhs[i] < rhs[j]) {
+            ++i;
+        }
+        else if (rhs[j] < lhs[i]) {
+            ++j;
+        }
+        else {
+            matches.emplace_back(i++, j++);
+        }
+    }
+}
+
+void IntersectSorted(const int* lhs, size_t lhs_size, const int* rhs, size_t rhs_size, std::vector<IntersectionMatch>& matches) {
+    if (lhs_size * GALLOPING_SIZE_RATIO < rhs_size) {
+        IntersectGalloping(lhs, lhs_size, rhs, rhs_size, matches);
+    }
+    else if (rhs_size * GALLOPING_SIZE_RATIO < lhs_size) {
+        const size_t first = matches.size();
+        IntersectGalloping(rhs, rhs_size, lhs, lhs_size, matches);
+        for (auto it = matches.begin() + first; it != matches.end(); ++it) {
+            std::swap(it->first, it->second);
+        }
+    }
+    else {
+        IntersectBlocks(lhs, lhs_size, rhs, rhs_size, matches);
+    }
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Positions of an element found in both of two sorted arrays of unique ids
+using IntersectionMatch = std::pair<size_t, size_t>;
+
+// Looks every element of the smaller array up in the larger one with exponential (galloping) search
+void IntersectGalloping(const int* small, size_t small_size, const int* large, size_t large_size, std::vector<IntersectionMatch>& matches);
+// Compares blocks of four ids at once (SSE2 when available), suits arrays of similar size
+void IntersectBlocks(const int* lhs, size_t lhs_size, const int* rhs, size_t rhs_size, std::vector<IntersectionMatch>& matches);
+// Picks the algorithm by the size ratio. Matches are appended in increasing order of positions
+void IntersectSorted(const int* lhs, size_t lhs_size, const int* rhs, size_t rhs_size, std::vector<IntersectionMatch>& matches);
@@ -0,0 +1,322 @@
+// Replays a captured query log against a SearchServer built from a corpus file (see LoadCorpus).
+// Queries arrive open-loop: each one is due at its logged time (scaled by --speed) no matter how slowly
+// the earlier ones were served, and --threads workers take them in order. The schedule is relative to the first
+// logged query, which is due at the start of the replay, so idle time before it is not replayed. Latency is measured both from
+// the actual start (service time) and from the due time, which includes waiting for a free worker and so
+// is not hidden by coordinated omission when the server falls behind.
+// Every result is hashed; the hashes and latency percentiles can be written as a baseline
+// and later runs compared with it, the exit code is 2 when they drift beyond the limits.
+//
+// Query log: one query per line, <timestamp ms>\t<ACTUAL|IRRELEVANT|BANNED|REMOVED>\t<query>
+//
+// Usage: query_replay <corpus> <query log> [--threads N] [--speed X] [--stop-words "..."]
+//                     [--write-baseline path] [--baseline path] [--max-latency-increase X] [--max-result-drift X]
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "corpus_loader.h"
+#include "search_server.h"
+
+using namespace std::literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+struct LoggedQuery {
+    double timestamp_ms = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::string text;
+};
+
+struct Outcome {
+    // Relative to the replay start
+    Clock::duration due{};
+    Clock::duration started{};
+    Clock::duration finished{};
+    uint64_t checksum = 0;
+    bool failed = false;
+};
+
+struct Baseline {
+    std::map<std::string, double> latencies_us;
+    std::vector<uint64_t> checksums;
+};
+
+std::string_view TakeField(std::string_view& line) {
+    const size_t end = std::min(line.find('\t'), line.size());
+    const std::string_view field = line.substr(0, end);
+    line.remove_prefix(std::min(end + 1, line.size()));
+    return field;
+}
+
+DocumentStatus ParseStatus(std::string_view text) {
+    if (text == "ACTUAL"sv) return DocumentStatus::ACTUAL;
+    if (text == "IRRELEVANT"sv) return DocumentStatus::IRRELEVANT;
+    if (text == "BANNED"sv) return DocumentStatus::BANNED;
+    if (text == "REMOVED"sv) return DocumentStatus::REMOVED;
+    throw std::invalid_argument("Bad status in query log");
+}
+
+// Log order is kept, timestamps are made relative to the first query;
+// queries logged earlier than it are due at once
+std::vector<LoggedQuery> ReadQueryLog(const std::string& path) {
+    MappedFile file(path);
+    std::string_view data = file.GetData();
+    std::vector<LoggedQuery> queries;
+    while (!data.empty()) {
+        const size_t end = std::min(data.find('\n'), data.size());
+        std::string_view line = data.substr(0, end);
+        data.remove_prefix(std::min(end + 1, data.size()));
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty()) continue;
+
+        LoggedQuery query;
+        const std::string_view timestamp = TakeField(line);
+        const auto [ptr, error] = std::from_chars(timestamp.data(), timestamp.data() + timestamp.size(), query.timestamp_ms);
+        if (error != std::errc() || ptr != timestamp.data() + timestamp.size()) throw std::invalid_argument("Bad timestamp in query log");
+        query.status = ParseStatus(TakeField(line));
+        query.text = line;
+        queries.push_back(std::move(query));
+    }
+    if (!queries.empty()) {
+        const double first = queries.front().timestamp_ms;
+        for (LoggedQuery& query : queries) {
+            query.timestamp_ms = std::max(0.0, query.timestamp_ms - first);
+        }
+    }
+    return queries;
+}
+
+// FNV-1a over the ids, ratings and relevances rounded to 1e-6, so that results equal up to rounding match
+uint64_t HashDocuments(const std::vector<Document>& documents) {
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash](int64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            hash ^= static_cast<uint64_t>(value >> (i * 8)) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+    };
+    for (const Document& document : documents) {
+        mix(document.id);
+        mix(document.rating);
+        mix(std::llround(document.relevance * 1e6));
+    }
+    return hash;
+}
+
+std::vector<Outcome> Replay(const SearchServer& search_server, const std::vector<LoggedQuery>& queries, int thread_count, double speed) {
+    std::vector<Outcome> outcomes(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        // Speed 0 replays as fast as possible: every query is due at the start
+        const double due_ms = speed > 0 ? queries[i].timestamp_ms / speed : 0.0;
+        outcomes[i].due = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(due_ms));
+    }
+    std::atomic<size_t> next = 0;
+    const Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < thread_count; ++thread) {
+        threads.emplace_back([&] {
+            for (size_t i = next++; i < queries.size(); i = next++) {
+                Outcome& outcome = outcomes[i];
+                std::this_thread::sleep_until(start + outcome.due);
+                outcome.started = Clock::now() - start;
+                try {
+                    outcome.checksum = HashDocuments(search_server.FindTopDocuments(queries[i].text, queries[i].status));
+                }
+                catch (const std::exception&) {
+                    outcome.failed = true;
+                }
+                outcome.finished = Clock::now() - start;
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return outcomes;
+}
+
+double Percentile(const std::vector<Clock::duration>& sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    const size_t index = std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+    return std::chrono::duration<double, std::micro>(sorted[index]).count();
+}
+
+// p50, p90, p99, p99.9 and max of the service and due-time latencies, in microseconds
+std::map<std::string, double> ComputeLatencies(const std::vector<Outcome>& outcomes) {
+    std::vector<Clock::duration> service;
+    std::vector<Clock::duration> corrected;
+    for (const Outcome& outcome : outcomes) {
+        service.push_back(outcome.finished - outcome.started);
+        corrected.push_back(outcome.finished - outcome.due);
+    }
+    std::sort(service.begin(), service.end());
+    std::sort(corrected.begin(), corrected.end());
+    std::map<std::string, double> result;
+    for (const auto& [name, fraction] : { std::pair{ "p50"s, 0.5 }, { "p90"s, 0.9 }, { "p99"s, 0.99 }, { "p99.9"s, 0.999 }, { "max"s, 1.0 } }) {
+        result["service_"s + name] = Percentile(service, fraction);
+        result["corrected_"s + name] = Percentile(corrected, fraction);
+    }
+    return result;
+}
+
+void PrintReport(const std::vector<Outcome>& outcomes, const std::map<std::string, double>& latencies) {
+    std::map<int64_t, std::vector<Clock::duration>> per_second;
+    size_t failed_count = 0;
+    uint64_t checksum = 0;
+    for (const Outcome& outcome : outcomes) {
+        per_second[std::chrono::duration_cast<std::chrono::seconds>(outcome.finished).count()].push_back(outcome.finished - outcome.due);
+        failed_count += outcome.failed;
+        checksum = checksum * 31 + outcome.checksum;
+    }
+    std::cout << std::fixed << std::setprecision(0);
+    std::cout << "second  queries  corrected p99 us"s << std::endl;
+    for (auto& [second, second_latencies] : per_second) {
+        std::sort(second_latencies.begin(), second_latencies.end());
+        std::cout << std::setw(6) << second << std::setw(9) << second_latencies.size()
+            << std::setw(18) << Percentile(second_latencies, 0.99) << std::endl;
+    }
+    const std::chrono::duration<double> elapsed = std::max_element(outcomes.begin(), outcomes.end(), [](const Outcome& lhs, const Outcome& rhs) {
+        return lhs.finished < rhs.finished;
+    })->finished;
+    std::cout << "Queries: "s << outcomes.size() << ", failed: "s << failed_count
+        << ", QPS: "s << outcomes.size() / std::max(elapsed.count(), 1e-9) << std::endl;
+    for (const std::string& kind : { "service"s, "corrected"s }) {
+        std::cout << "Latency us ("s << kind << "): p50 = "s << latencies.at(kind + "_p50"s) << ", p90 = "s << latencies.at(kind + "_p90"s)
+            << ", p99 = "s << latencies.at(kind + "_p99"s) << ", p99.9 = "s << latencies.at(kind + "_p99.9"s)
+            << ", max = "s << latencies.at(kind + "_max"s) << std::endl;
+    }
+    std::cout << "Result checksum: "s << std::hex << checksum << std::dec << std::endl;
+}
+
+// Text file: "<latency name> <microseconds>" lines, then "checksums <count>" and one hex hash per query
+void WriteBaseline(const std::string& path, const std::vector<Outcome>& outcomes, const std::map<std::string, double>& latencies) {
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("Can't write "s + path);
+    out << std::fixed << std::setprecision(1);
+    for (const auto& [name, value] : latencies) {
+        out << name << ' ' << value << '\n';
+    }
+    out << "checksums "s << outcomes.size() << '\n' << std::hex;
+    for (const Outcome& outcome : outcomes) {
+        out << outcome.checksum << '\n';
+    }
+    if (!out) throw std::runtime_error("Can't write "s + path);
+}
+
+Baseline ReadBaseline(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("Can't read "s + path);
+    Baseline baseline;
+    std::string name;
+    while (in >> name) {
+        if (name == "checksums"s) {
+            size_t count = 0;
+            in >> count >> std::hex;
+            baseline.checksums.resize(count);
+            for (uint64_t& checksum : baseline.checksums) {
+                in >> checksum;
+            }
+            break;
+        }
+        in >> baseline.latencies_us[name];
+    }
+    if (in.fail()) throw std::invalid_argument("Bad baseline "s + path);
+    return baseline;
+}
+
+// Returns false if the corrected latencies or the results drifted beyond the limits
+bool CompareWithBaseline(const Baseline& baseline, const std::vector<Outcome>& outcomes, const std::map<std::string, double>& latencies,
+    double max_latency_increase, double max_result_drift) {
+    bool ok = true;
+    std::cout << std::fixed << std::setprecision(2);
+    for (const std::string& name : { "corrected_p50"s, "corrected_p99"s }) {
+        const auto it = baseline.latencies_us.find(name);
+        if (it == baseline.latencies_us.end() || it->second <= 0) continue;
+        const double increase = latencies.at(name) / it->second - 1;
+        const bool name_ok = increase <= max_latency_increase;
+        std::cout << (name_ok ? "OK   "s : "FAIL "s) << name << " changed by "s << increase * 100 << "% (limit "s << max_latency_increase * 100 << "%)"s << std::endl;
+        ok = ok && name_ok;
+    }
+    if (baseline.checksums.size() != outcomes.size()) {
+        std::cout << "FAIL baseline has "s << baseline.checksums.size() << " queries, the log has "s << outcomes.size() << std::endl;
+        return false;
+    }
+    size_t changed_count = 0;
+    for (size_t i = 0; i < outcomes.size(); ++i) {
+        changed_count += outcomes[i].checksum != baseline.checksums[i];
+    }
+    const double drift = outcomes.empty() ? 0.0 : static_cast<double>(changed_count) / outcomes.size();
+    const bool results_ok = drift <= max_result_drift;
+    std::cout << (results_ok ? "OK   "s : "FAIL "s) << changed_count << " results changed, "s << drift * 100 << "% (limit "s << max_result_drift * 100 << "%)"s << std::endl;
+    return ok && results_ok;
+}
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: "s << argv[0] << " <corpus> <query log> [--threads N] [--speed X] [--stop-words \"...\"]"s
+            << " [--write-baseline path] [--baseline path] [--max-latency-increase X] [--max-result-drift X]"s << std::endl;
+        return 1;
+    }
+    std::map<std::string, std::string> options = {
+        {"--threads"s, std::to_string(std::max(1u, std::thread::hardware_concurrency()))},
+        {"--speed"s, "1"s},
+        {"--stop-words"s, ""s},
+        {"--write-baseline"s, ""s},
+        {"--baseline"s, ""s},
+        {"--max-latency-increase"s, "0.5"s},
+        {"--max-result-drift"s, "0"s},
+    };
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (options.count(argv[i]) == 0) {
+            std::cerr << "Unknown option "s << argv[i] << std::endl;
+            return 1;
+        }
+        options[argv[i]] = argv[i + 1];
+    }
+
+    try {
+        const int thread_count = std::stoi(options["--threads"s]);
+        const double speed = std::stod(options["--speed"s]);
+        if (thread_count < 1 || speed < 0) throw std::invalid_argument("Threads must be positive and speed not negative");
+
+        SearchServer search_server(options["--stop-words"s]);
+        const auto load_start = Clock::now();
+        const size_t document_count = LoadCorpus(search_server, argv[1]);
+        const std::vector<LoggedQuery> queries = ReadQueryLog(argv[2]);
+        const std::chrono::duration<double> load_time = Clock::now() - load_start;
+        std::cout << "Loaded "s << document_count << " documents and "s << queries.size() << " queries in "s << load_time.count() << " s"s << std::endl;
+        if (queries.empty()) throw std::invalid_argument("Query log is empty");
+
+        const std::vector<Outcome> outcomes = Replay(search_server, queries, thread_count, speed);
+        const std::map<std::string, double> latencies = ComputeLatencies(outcomes);
+        PrintReport(outcomes, latencies);
+
+        if (!options["--write-baseline"s].empty()) {
+            WriteBaseline(options["--write-baseline"s], outcomes, latencies);
+        }
+        if (!options["--baseline"s].empty()) {
+            const Baseline baseline = ReadBaseline(options["--baseline"s]);
+            if (!CompareWithBaseline(baseline, outcomes, latencies, std::stod(options["--max-latency-increase"s]), std::stod(options["--max-result-drift"s]))) {
+                return 2;
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
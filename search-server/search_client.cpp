@@ -0,0 +1,233 @@
+// Load generator for search_daemon: optionally fills the daemon with generated documents,
+// then keeps a fixed number of pipelined FIND requests in flight on every connection
+// and reports throughput and latency percentiles.
+// --check-order N instead pipelines interleaved ADD/REMOVE/FIND requests for N documents on one connection
+// and fails if a FIND doesn't see the updates sent before it.
+//
+// Usage: search_client <socket path | tcp:port> [--connections N] [--requests N] [--pipeline N] [--documents N] [--query-words N] [--check-order N]
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "search_protocol.h"
+
+using namespace std::literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+std::string GenerateWord(std::mt19937& generator, int max_length) {
+    const int length = std::uniform_int_distribution(1, max_length)(generator);
+    std::string word;
+    for (int i = 0; i < length; ++i) {
+        word.push_back(static_cast<char>(std::uniform_int_distribution('a', 'z')(generator)));
+    }
+    return word;
+}
+
+std::string GenerateText(std::mt19937& generator, const std::vector<std::string>& dictionary, int word_count) {
+    std::string text;
+    for (int i = 0; i < word_count; ++i) {
+        if (!text.empty()) text.push_back(' ');
+        text += dictionary[std::uniform_int_distribution<size_t>(0, dictionary.size() - 1)(generator)];
+    }
+    return text;
+}
+
+// Sends requests keeping at most pipeline of them unanswered, returns latency of every request.
+// Responses are stored by request id if asked
+std::vector<Clock::duration> RunRequests(const std::string& address, const std::vector<Request>& requests, size_t pipeline, size_t& errors,
+    std::map<uint32_t, Response>* responses = nullptr) {
+    const int fd = ConnectSocket(address);
+    std::vector<Clock::duration> latencies;
+    latencies.reserve(requests.size());
+    std::map<uint32_t, Clock::time_point> sent;
+    std::string input;
+    size_t next = 0;
+    while (latencies.size() < requests.size()) {
+        std::string output;
+        for (; next < requests.size() && sent.size() < pipeline; ++next) {
+            EncodeRequest(requests[next], output);
+            sent[requests[next].request_id] = Clock::now();
+        }
+        for (size_t pos = 0; pos < output.size();) {
+            const ssize_t size = ::send(fd, output.data() + pos, output.size() - pos, MSG_NOSIGNAL);
+            if (size < 0) throw std::runtime_error("Connection lost");
+            pos += static_cast<size_t>(size);
+        }
+
+        char chunk[1 << 16];
+        const ssize_t size = ::read(fd, chunk, sizeof(chunk));
+        if (size <= 0) throw std::runtime_error("Connection lost");
+        input.append(chunk, static_cast<size_t>(size));
+        std::string_view data = input;
+        for (Response response; DecodeResponse(data, response);) {
+            const auto it = sent.find(response.request_id);
+            if (it == sent.end()) throw std::runtime_error("Unexpected response");
+            latencies.push_back(Clock::now() - it->second);
+            sent.erase(it);
+            errors += !response.ok;
+            if (responses) (*responses)[response.request_id] = std::move(response);
+        }
+        input.erase(0, input.size() - data.size());
+    }
+    ::close(fd);
+    return latencies;
+}
+
+// Pipelines rounds of ADD, FIND, REMOVE, FIND for every id on one connection, the daemon must apply
+// updates in arrival order and let every FIND see the updates sent before it. Returns false on a violation
+bool CheckUpdateOrder(const std::string& address, int id_count) {
+    const int first_id = 1'000'000'000;
+    std::vector<Request> requests;
+    // Expected number of found documents for FIND requests, -1 for updates
+    std::vector<int> expected;
+    auto add_request = [&](RequestType type, int id, int expected_count) {
+        Request request;
+        request.request_id = static_cast<uint32_t>(requests.size());
+        request.type = type;
+        request.document_id = id;
+        request.text = "ordercheck"s + std::to_string(id);
+        request.ratings = { 1 };
+        requests.push_back(std::move(request));
+        expected.push_back(expected_count);
+    };
+    for (int round = 0; round < 3; ++round) {
+        for (int id = first_id; id < first_id + id_count; ++id) {
+            add_request(RequestType::ADD, id, -1);
+            add_request(RequestType::FIND, id, 1);
+        }
+        for (int id = first_id; id < first_id + id_count; ++id) {
+            add_request(RequestType::REMOVE, id, -1);
+            add_request(RequestType::FIND, id, 0);
+        }
+    }
+    size_t errors = 0;
+    std::map<uint32_t, Response> responses;
+    RunRequests(address, requests, 64, errors, &responses);
+    size_t violations = 0;
+    for (const Request& request : requests) {
+        const Response& response = responses.at(request.request_id);
+        const int expected_count = expected[request.request_id];
+        if (!response.ok || (expected_count >= 0 && response.documents.size() != static_cast<size_t>(expected_count))) ++violations;
+    }
+    std::cout << "Update order check: "s << requests.size() << " requests, "s << violations << " violations"s << std::endl;
+    return violations == 0;
+}
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: "s << argv[0] << " <socket path | tcp:port> [--connections N] [--requests N] [--pipeline N] [--documents N] [--query-words N] [--check-order N]"s << std::endl;
+        return 1;
+    }
+    const std::string address = argv[1];
+    std::map<std::string, int> options = { {"--connections"s, 8}, {"--requests"s, 10000}, {"--pipeline"s, 16}, {"--documents"s, 0}, {"--query-words"s, 3}, {"--check-order"s, 0} };
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (options.count(argv[i]) == 0) {
+            std::cerr << "Unknown option "s << argv[i] << std::endl;
+            return 1;
+        }
+        options[argv[i]] = std::stoi(argv[i + 1]);
+    }
+
+    std::mt19937 generator;
+    std::vector<std::string> dictionary;
+    for (int i = 0; i < 1000; ++i) {
+        dictionary.push_back(GenerateWord(generator, 10));
+    }
+
+    try {
+        if (options["--documents"s] > 0) {
+            std::vector<Request> adds;
+            for (int id = 0; id < options["--documents"s]; ++id) {
+                Request request;
+                request.request_id = static_cast<uint32_t>(id);
+                request.type = RequestType::ADD;
+                request.document_id = id;
+                request.ratings = { 1, 2, 3 };
+                request.text = GenerateText(generator, dictionary, 70);
+                adds.push_back(std::move(request));
+            }
+            size_t errors = 0;
+            const auto start = Clock::now();
+            RunRequests(address, adds, 256, errors);
+            const std::chrono::duration<double> elapsed = Clock::now() - start;
+            std::cout << "Added "s << adds.size() << " documents in "s << elapsed.count() << " s, errors: "s << errors << std::endl;
+        }
+
+        if (options["--check-order"s] > 0) {
+            return CheckUpdateOrder(address, options["--check-order"s]) ? 0 : 1;
+        }
+
+        const size_t connection_count = std::max(1, options["--connections"s]);
+        const size_t requests_per_connection = std::max(1, options["--requests"s]) / connection_count;
+        std::vector<std::vector<Request>> requests(connection_count);
+        for (auto& connection_requests : requests) {
+            for (size_t i = 0; i < requests_per_connection; ++i) {
+                Request request;
+                request.request_id = static_cast<uint32_t>(i);
+                request.text = GenerateText(generator, dictionary, options["--query-words"s]);
+                connection_requests.push_back(std::move(request));
+            }
+        }
+
+        std::vector<std::vector<Clock::duration>> latencies(connection_count);
+        std::vector<size_t> errors(connection_count);
+        // An exception escaping a thread would terminate the client, it is reported after the join instead
+        std::vector<std::exception_ptr> failures(connection_count);
+        const size_t pipeline = std::max(1, options["--pipeline"s]);
+        std::vector<std::thread> threads;
+        const auto start = Clock::now();
+        for (size_t i = 0; i < connection_count; ++i) {
+            threads.emplace_back([&, i] {
+                try {
+                    latencies[i] = RunRequests(address, requests[i], pipeline, errors[i]);
+                }
+                catch (...) {
+                    failures[i] = std::current_exception();
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        for (const std::exception_ptr& failure : failures) {
+            if (failure) std::rethrow_exception(failure);
+        }
+        const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+        std::vector<Clock::duration> all;
+        for (const auto& connection_latencies : latencies) {
+            all.insert(all.end(), connection_latencies.begin(), connection_latencies.end());
+        }
+        std::sort(all.begin(), all.end());
+        auto percentile = [&all](double fraction) -> std::chrono::microseconds::rep {
+            if (all.empty()) return 0;
+            const size_t index = std::min(all.size() - 1, static_cast<size_t>(fraction * all.size()));
+            return std::chrono::duration_cast<std::chrono::microseconds>(all[index]).count();
+        };
+        size_t error_count = 0;
+        for (const size_t count : errors) {
+            error_count += count;
+        }
+        std::cout << "Requests: "s << all.size() << ", errors: "s << error_count << std::endl;
+        std::cout << "QPS: "s << all.size() / elapsed.count() << std::endl;
+        std::cout << "Latency us: p50 = "s << percentile(0.5) << ", p90 = "s << percentile(0.9) << ", p99 = "s << percentile(0.99)
+            << ", p99.9 = "s << percentile(0.999) << ", max = "s << percentile(1.0) << std::endl;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
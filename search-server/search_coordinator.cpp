@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "search_coordinator.h"
+#include "corpus_loader.h"
+
+namespace {
+// Sends what the socket buffer takes without blocking and leaves the rest in data
+bool SendAvailable(int fd, std::string_view& data) {
+    while (!data.empty()) {
+        const ssize_t size = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (size < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        data.remove_prefix(static_cast<size_t>(size));
+    }
+    return true;
+}
+
+// Same order as SearchServer::FindTopDocuments
+void SelectTopDocuments(std::vector<Document>& documents) {
+    std::sort(documents.begin(), documents.end(),
+        [](const Document& lhs, const Document& rhs) {
+            if (std::abs(lhs.relevance - rhs.relevance) < DELTA) {
+                return lhs.rating != rhs.rating ? lhs.rating > rhs.rating : lhs.id < rhs.id;
+            }
+            else {
+                return lhs.relevance > rhs.relevance;
+            }
+        });
+    if (documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
+        documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+    }
+}
+}
+
+SearchCoordinator::SearchCoordinator(std::vector<std::string> shard_addresses, std::chrono::milliseconds timeout)
+    : timeout_(timeout) {
+    if (shard_addresses.empty()) throw std::invalid_argument("No shards");
+    for (std::string& address : shard_addresses) {
+        shards_.push_back({ std::move(address), -1, {} });
+    }
+}
+
+SearchCoordinator::~SearchCoordinator() {
+    for (Shard& shard : shards_) {
+        Disconnect(shard);
+    }
+}
+
+int SearchCoordinator::GetShardCount() const {
+    return static_cast<int>(shards_.size());
+}
+
+DistributedResult SearchCoordinator::FindTopDocuments(std::string_view raw_query, QueryMode mode, DocumentStatus status) {
+    std::vector<int> all_shards(shards_.size());
+    std::iota(all_shards.begin(), all_shards.end(), 0);
+
+    DistributedResult result;
+    Request request;
+    request.type = RequestType::STATS;
+    request.text = std::string(raw_query);
+    const std::vector<std::optional<Response>> statistics_responses = Exchange(all_shards, request, std::chrono::steady_clock::now() + timeout_);
+
+    CorpusStatistics statistics;
+    std::vector<int> ranking_shards;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        const std::optional<Response>& response = statistics_responses[i];
+        if (!response) {
+            result.missing_shards.push_back(static_cast<int>(i));
+            continue;
+        }
+        if (!response->ok) throw std::invalid_argument(response->error);
+        statistics.document_count += response->statistics.document_count;
+        for (const auto& [word, document_count] : response->statistics.word_document_counts) {
+            statistics.word_document_counts[word] += document_count;
+        }
+        ranking_shards.push_back(static_cast<int>(i));
+    }
+
+    request.type = RequestType::FIND;
+    request.mode = mode;
+    request.status = status;
+    request.statistics = std::move(statistics);
+    const std::vector<std::optional<Response>> find_responses = Exchange(ranking_shards, std::move(request), std::chrono::steady_clock::now() + timeout_);
+    for (size_t i = 0; i < ranking_shards.size(); ++i) {
+        const std::optional<Response>& response = find_responses[i];
+        if (!response) {
+            result.missing_shards.push_back(ranking_shards[i]);
+            continue;
+        }
+        if (!response->ok) throw std::invalid_argument(response->error);
+        result.documents.insert(result.documents.end(), response->documents.begin(), response->documents.end());
+    }
+    std::sort(result.missing_shards.begin(), result.missing_shards.end());
+    SelectTopDocuments(result.documents);
+    return result;
+}
+
+void SearchCoordinator::AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
+    Request request;
+    request.type = RequestType::ADD;
+    request.document_id = document_id;
+    request.status = status;
+    request.ratings = ratings;
+    request.text = std::string(document);
+    ExchangeWithOwner(document_id, std::move(request));
+}
+
+void SearchCoordinator::RemoveDocument(int document_id) {
+    Request request;
+    request.type = RequestType::REMOVE;
+    request.document_id = document_id;
+    ExchangeWithOwner(document_id, std::move(request));
+}
+
+std::tuple<std::vector<std::string>, DocumentStatus> SearchCoordinator::MatchDocument(std::string_view raw_query, int document_id) {
+    Request request;
+    request.type = RequestType::MATCH;
+    request.document_id = document_id;
+    request.text = std::string(raw_query);
+    Response response = ExchangeWithOwner(document_id, std::move(request));
+    return { std::move(response.words), response.status };
+}
+
+Response SearchCoordinator::ExchangeWithOwner(int document_id, Request request) {
+    if (document_id < 0) throw std::invalid_argument("Invalid document_id");
+    const int shard = GetDocumentShard(document_id, GetShardCount());
+    std::optional<Response> response = std::move(Exchange({ shard }, std::move(request), std::chrono::steady_clock::now() + timeout_).front());
+    if (!response) throw std::runtime_error("Shard " + shards_[shard].address + " is unavailable");
+    if (!response->ok) throw std::invalid_argument(response->error);
+    return std::move(*response);
+}
+
+std::vector<std::optional<Response>> SearchCoordinator::Exchange(const std::vector<int>& shards, Request request, std::chrono::steady_clock::time_point deadline) {
+    request.request_id = next_request_id_++;
+    std::string message;
+    EncodeRequest(request, message);
+
+    std::vector<std::optional<Response>> responses(shards.size());
+    std::vector<pollfd> waiting;
+    std::vector<size_t> waiting_positions;
+    // Part of the request a shard has not taken yet, sent when its socket becomes writable
+    std::vector<std::string_view> unsent;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        Shard& shard = shards_[shards[i]];
+        if (shard.fd < 0) {
+            try {
+                shard.fd = ConnectSocket(shard.address);
+            }
+            catch (const std::runtime_error&) {
+                continue;
+            }
+            // A stalled shard must not block the round past the deadline
+            ::fcntl(shard.fd, F_SETFL, ::fcntl(shard.fd, F_GETFL) | O_NONBLOCK);
+        }
+        std::string_view data = message;
+        if (!SendAvailable(shard.fd, data)) {
+            Disconnect(shard);
+            continue;
+        }
+        waiting.push_back({ shard.fd, static_cast<short>(data.empty() ? POLLIN : POLLIN | POLLOUT), 0 });
+        waiting_positions.push_back(i);
+        unsent.push_back(data);
+    }
+
+    while (!waiting.empty()) {
+        const auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) break;
+        const int ready = ::poll(waiting.data(), waiting.size(), static_cast<int>(left.count()));
+        if (ready < 0 && errno != EINTR) break;
+        if (ready <= 0) continue;
+        for (size_t i = 0; i < waiting.size();) {
+            const size_t position = waiting_positions[i];
+            Shard& shard = shards_[shards[position]];
+            bool keep_waiting = true;
+            if (waiting[i].revents & POLLOUT) {
+                keep_waiting = SendAvailable(shard.fd, unsent[i]);
+                if (!keep_waiting) {
+                    Disconnect(shard);
+                }
+                else if (unsent[i].empty()) {
+                    waiting[i].events = POLLIN;
+                }
+            }
+            if (keep_waiting && (waiting[i].revents & ~POLLOUT) != 0) {
+                keep_waiting = Receive(shard, request.request_id, responses[position]);
+            }
+            if (!keep_waiting) {
+                waiting.erase(waiting.begin() + i);
+                waiting_positions.erase(waiting_positions.begin() + i);
+                unsent.erase(unsent.begin() + i);
+            }
+            else {
+                ++i;
+            }
+        }
+    }
+    // A request cut off in the middle would break the stream for the next rounds
+    for (size_t i = 0; i < waiting.size(); ++i) {
+        if (!unsent[i].empty()) Disconnect(shards_[shards[waiting_positions[i]]]);
+    }
+    return responses;
+}
+
+bool SearchCoordinator::Receive(Shard& shard, uint32_t request_id, std::optional<Response>& response) {
+    char chunk[1 << 16];
+    const ssize_t size = ::read(shard.fd, chunk, sizeof(chunk));
+    if (size < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+    if (size <= 0) {
+        Disconnect(shard);
+        return false;
+    }
+    shard.input.append(chunk, static_cast<size_t>(size));
+
+    std::string_view data = shard.input;
+    try {
+        for (Response decoded; DecodeResponse(data, decoded);) {
+            // Responses to requests that timed out earlier
+            if (decoded.request_id != request_id) continue;
+            response = std::move(decoded);
+        }
+    }
+    catch (const std::invalid_argument&) {
+        Disconnect(shard);
+        return false;
+    }
+    shard.input.erase(0, shard.input.size() - data.size());
+    return !response;
+}
+
+void SearchCoordinator::Disconnect(Shard& shard) {
+    if (shard.fd >= 0) ::close(shard.fd);
+    shard.fd = -1;
+    shard.input.clear();
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "document.h"
+#include "search_protocol.h"
+#include "search_server.h"
+
+struct DistributedResult {
+    std::vector<Document> documents;
+    // Shards left out of the result because they failed or didn't answer in time
+    std::vector<int> missing_shards;
+};
+
+// Client of search daemons each holding one shard of a corpus, documents are placed by GetDocumentShard.
+// A query takes two rounds: document frequencies of the query words are summed over the shards,
+// then every shard ranks its documents with these global statistics and the top documents are merged.
+// So results match one SearchServer holding the whole corpus, except for prefixes expanded to
+// more than MAX_PREFIX_EXPANSION_COUNT words, which every shard limits by its own dictionary.
+// Handles one request at a time
+class SearchCoordinator {
+public:
+    explicit SearchCoordinator(std::vector<std::string> shard_addresses, std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+    ~SearchCoordinator();
+    SearchCoordinator(const SearchCoordinator&) = delete;
+    SearchCoordinator& operator=(const SearchCoordinator&) = delete;
+
+    // Shards not answering within the timeout (applied to each round) are left out,
+    // the result is ranked as if the corpus had only the others.
+    // Throws std::invalid_argument if the shards reject the query
+    DistributedResult FindTopDocuments(std::string_view raw_query, QueryMode mode = QueryMode::ANY, DocumentStatus status = DocumentStatus::ACTUAL);
+
+    // Requests to the shard owning the document. Throw std::runtime_error if it doesn't answer in time
+    // (the request may still be executed) and std::invalid_argument if it rejects the request
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    void RemoveDocument(int document_id);
+    std::tuple<std::vector<std::string>, DocumentStatus> MatchDocument(std::string_view raw_query, int document_id);
+
+    int GetShardCount() const;
+
+private:
+    struct Shard {
+        std::string address;
+        int fd = -1;
+        // Received bytes not decoded yet
+        std::string input;
+    };
+
+    std::vector<Shard> shards_;
+    const std::chrono::milliseconds timeout_;
+    uint32_t next_request_id_ = 0;
+
+    // Sends the request to the shards and waits for their responses until the deadline, missing ones are std::nullopt.
+    // Broken connections are reestablished by the next exchange, late responses are skipped by request id
+    std::vector<std::optional<Response>> Exchange(const std::vector<int>& shards, Request request, std::chrono::steady_clock::time_point deadline);
+    Response ExchangeWithOwner(int document_id, Request request);
+    // Reads what is available, returns false when nothing more is expected from the shard
+    bool Receive(Shard& shard, uint32_t request_id, std::optional<Response>& response);
+    static void Disconnect(Shard& shard);
+};
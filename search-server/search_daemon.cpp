@@ -0,0 +1,451 @@
+// Query-serving daemon: holds one SearchServer and answers pipelined requests of search_protocol.h.
+// An epoll loop does all socket I/O, a worker pool executes requests: queued FIND/MATCH requests
+// are taken in micro-batches and run in parallel under a shared lock, ADD/REMOVE run exclusively.
+// Requests take effect in arrival order: updates are applied one at a time, an update waits for the queries
+// received before it and the queries received after it wait for the update.
+// Responses of one connection may come out of order, clients match them by request id.
+// A daemon may serve one shard of a corpus split by GetDocumentShard, see distributed_search.cpp.
+//
+// Usage: search_daemon <socket path | tcp:port> [--stop-words "a b"] [--corpus file] [--shard K/N] [--workers N] [--batch N] [--batch-window-us N]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <execution>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "search_server.h"
+#include "search_protocol.h"
+#include "corpus_loader.h"
+
+using namespace std::literals;
+
+namespace {
+std::atomic<bool> stop_requested = false;
+// Bytes taken from one connection per event: the buffered input stays within a message plus this,
+// and the level-triggered epoll reports the rest of the data again
+const size_t MAX_READ_SIZE = 1 << 20;
+
+void RequestStop(int) {
+    stop_requested = true;
+}
+
+void SetNonBlocking(int fd) {
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+}
+
+class SearchDaemon {
+public:
+    struct Options {
+        std::string address;
+        std::string stop_words;
+        std::string corpus_path;
+        int shard = 0;
+        int shard_count = 1;
+        size_t worker_count = std::max(1u, std::thread::hardware_concurrency());
+        size_t max_batch_size = 64;
+        std::chrono::microseconds batch_window = 100us;
+    };
+
+    explicit SearchDaemon(const Options& options)
+        : options_(options)
+        , search_server_(options.stop_words) {}
+
+    void Run() {
+        if (!options_.corpus_path.empty()) {
+            std::cerr << "Loaded "s << LoadCorpus(search_server_, options_.corpus_path, options_.shard, options_.shard_count) << " documents"s << std::endl;
+        }
+        listen_fd_ = ListenSocket(options_.address);
+        SetNonBlocking(listen_fd_);
+        epoll_fd_ = ::epoll_create1(0);
+        wake_fd_ = ::eventfd(0, EFD_NONBLOCK);
+        Watch(listen_fd_, EPOLLIN);
+        Watch(wake_fd_, EPOLLIN);
+
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < options_.worker_count; ++i) {
+            workers.emplace_back([this] { WorkerLoop(); });
+        }
+
+        epoll_event events[128];
+        while (!stop_requested) {
+            const int count = ::epoll_wait(epoll_fd_, events, 128, 200);
+            for (int i = 0; i < count; ++i) {
+                const int fd = events[i].data.fd;
+                if (fd == listen_fd_) {
+                    Accept();
+                }
+                else if (fd == wake_fd_) {
+                    DeliverResponses();
+                }
+                else {
+                    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) Read(fd);
+                    if (connections_.count(fd) && (events[i].events & EPOLLOUT)) Write(fd);
+                }
+            }
+        }
+
+        {
+            std::lock_guard guard(tasks_mutex_);
+            stopping_ = true;
+        }
+        tasks_changed_.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        for (const auto& [fd, _] : connections_) {
+            ::close(fd);
+        }
+        ::close(wake_fd_);
+        ::close(epoll_fd_);
+        ::close(listen_fd_);
+        if (options_.address.rfind("tcp:", 0) != 0) ::unlink(options_.address.c_str());
+    }
+
+private:
+    struct Connection {
+        uint64_t id;
+        std::string input;
+        std::string output;
+        bool writing = false;
+    };
+
+    struct Task {
+        uint64_t connection_id;
+        Request request;
+        std::chrono::steady_clock::time_point arrival;
+        // Arrival order over all connections
+        uint64_t sequence = 0;
+    };
+
+    const Options options_;
+    SearchServer search_server_;
+    std::shared_mutex search_server_mutex_;
+
+    int listen_fd_ = -1;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    std::map<int, Connection> connections_;
+    std::map<uint64_t, int> connection_fds_;
+    uint64_t next_connection_id_ = 0;
+
+    std::mutex tasks_mutex_;
+    std::condition_variable tasks_changed_;
+    std::deque<Task> queries_;
+    std::deque<Task> updates_;
+    uint64_t next_task_sequence_ = 0;
+    bool is_updating_ = false;
+    size_t running_query_batch_count_ = 0;
+    bool stopping_ = false;
+
+    std::mutex responses_mutex_;
+    std::vector<std::pair<uint64_t, std::string>> responses_;
+
+    void Watch(int fd, uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void Accept() {
+        for (int fd; (fd = ::accept(listen_fd_, nullptr, nullptr)) >= 0;) {
+            SetNonBlocking(fd);
+            Watch(fd, EPOLLIN);
+            connections_[fd] = { next_connection_id_, {}, {} };
+            connection_fds_[next_connection_id_++] = fd;
+        }
+    }
+
+    void Close(int fd) {
+        connection_fds_.erase(connections_.at(fd).id);
+        connections_.erase(fd);
+        ::close(fd);
+    }
+
+    void Read(int fd) {
+        Connection& connection = connections_.at(fd);
+        char chunk[1 << 16];
+        bool is_closed = false;
+        for (size_t read_size = 0; read_size < MAX_READ_SIZE;) {
+            const ssize_t size = ::read(fd, chunk, sizeof(chunk));
+            if (size > 0) {
+                connection.input.append(chunk, static_cast<size_t>(size));
+                read_size += static_cast<size_t>(size);
+                continue;
+            }
+            if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (size < 0) {
+                Close(fd);
+                return;
+            }
+            // Requests received before the client closed its end are still executed
+            is_closed = true;
+            break;
+        }
+
+        std::vector<Task> tasks;
+        std::string_view data = connection.input;
+        try {
+            for (Request request; DecodeRequest(data, request);) {
+                tasks.push_back({ connection.id, std::move(request), std::chrono::steady_clock::now() });
+            }
+        }
+        catch (const std::invalid_argument&) {
+            Close(fd);
+            return;
+        }
+        connection.input.erase(0, connection.input.size() - data.size());
+        if (is_closed) Close(fd);
+        if (tasks.empty()) return;
+        {
+            std::lock_guard guard(tasks_mutex_);
+            for (Task& task : tasks) {
+                task.sequence = next_task_sequence_++;
+                const bool is_update = task.request.type == RequestType::ADD || task.request.type == RequestType::REMOVE;
+                (is_update ? updates_ : queries_).push_back(std::move(task));
+            }
+        }
+        tasks_changed_.notify_all();
+    }
+
+    void Write(int fd) {
+        Connection& connection = connections_.at(fd);
+        while (!connection.output.empty()) {
+            const ssize_t size = ::send(fd, connection.output.data(), connection.output.size(), MSG_NOSIGNAL);
+            if (size < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                Close(fd);
+                return;
+            }
+            connection.output.erase(0, static_cast<size_t>(size));
+        }
+        const bool writing = !connection.output.empty();
+        if (writing != connection.writing) {
+            connection.writing = writing;
+            epoll_event event{};
+            event.events = EPOLLIN | (writing ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+            event.data.fd = fd;
+            ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+        }
+    }
+
+    void DeliverResponses() {
+        uint64_t counter = 0;
+        while (::read(wake_fd_, &counter, sizeof(counter)) > 0) {}
+        std::vector<std::pair<uint64_t, std::string>> responses;
+        {
+            std::lock_guard guard(responses_mutex_);
+            responses.swap(responses_);
+        }
+        std::vector<int> touched;
+        for (auto& [connection_id, data] : responses) {
+            const auto fd = connection_fds_.find(connection_id);
+            // The client may have disconnected meanwhile
+            if (fd == connection_fds_.end()) continue;
+            connections_.at(fd->second).output += data;
+            touched.push_back(fd->second);
+        }
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        for (const int fd : touched) {
+            if (connections_.count(fd)) Write(fd);
+        }
+    }
+
+    void WorkerLoop() {
+        while (true) {
+            std::vector<Task> batch;
+            bool is_update = false;
+            {
+                std::unique_lock lock(tasks_mutex_);
+                tasks_changed_.wait(lock, [this] { return stopping_ || CanTakeUpdate() || CountReadyQueries() > 0; });
+                if (stopping_) return;
+                if (CanTakeUpdate()) {
+                    is_update = true;
+                    is_updating_ = true;
+                    batch.push_back(std::move(updates_.front()));
+                    updates_.pop_front();
+                }
+                else {
+                    // Give concurrent clients a short window to fill the batch
+                    const auto deadline = queries_.front().arrival + options_.batch_window;
+                    tasks_changed_.wait_until(lock, deadline, [this] {
+                        const size_t ready_count = CountReadyQueries();
+                        return stopping_ || ready_count == 0 || ready_count >= options_.max_batch_size;
+                    });
+                    const size_t size = CountReadyQueries();
+                    std::move(queries_.begin(), queries_.begin() + size, std::back_inserter(batch));
+                    queries_.erase(queries_.begin(), queries_.begin() + size);
+                    if (size > 0) ++running_query_batch_count_;
+                }
+            }
+            if (batch.empty()) continue;
+
+            std::vector<std::string> encoded(batch.size());
+            if (is_update) {
+                std::unique_lock lock(search_server_mutex_);
+                EncodeResponse(Execute(batch.front().request), encoded.front());
+            }
+            else {
+                std::shared_lock lock(search_server_mutex_);
+                std::transform(
+                    std::execution::par,
+                    batch.begin(), batch.end(),
+                    encoded.begin(),
+                    [this](const Task& task) {
+                        std::string out;
+                        EncodeResponse(Execute(task.request), out);
+                        return out;
+                    }
+                );
+            }
+            {
+                std::lock_guard guard(tasks_mutex_);
+                if (is_update) {
+                    is_updating_ = false;
+                }
+                else {
+                    --running_query_batch_count_;
+                }
+            }
+            tasks_changed_.notify_all();
+
+            {
+                std::lock_guard guard(responses_mutex_);
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    responses_.emplace_back(batch[i].connection_id, std::move(encoded[i]));
+                }
+            }
+            const uint64_t one = 1;
+            ::write(wake_fd_, &one, sizeof(one));
+        }
+    }
+
+    // The oldest update goes when no other update runs and the queries received before it are done.
+    // Called with tasks_mutex_ held
+    bool CanTakeUpdate() const {
+        return !updates_.empty() && !is_updating_ && running_query_batch_count_ == 0
+            && (queries_.empty() || queries_.front().sequence > updates_.front().sequence);
+    }
+
+    // Queries at the front received before any pending or running update, at most a batch of them.
+    // Called with tasks_mutex_ held
+    size_t CountReadyQueries() const {
+        if (is_updating_) return 0;
+        const uint64_t barrier = updates_.empty() ? UINT64_MAX : updates_.front().sequence;
+        size_t count = 0;
+        while (count < queries_.size() && count < options_.max_batch_size && queries_[count].sequence < barrier) {
+            ++count;
+        }
+        return count;
+    }
+
+    // Callers hold the server lock matching the request type
+    Response Execute(const Request& request) {
+        Response response;
+        response.request_id = request.request_id;
+        response.type = request.type;
+        try {
+            switch (request.type) {
+            case RequestType::FIND:
+                response.documents = request.statistics
+                    ? search_server_.FindTopDocuments(*request.statistics, request.text, request.mode, request.status)
+                    : search_server_.FindTopDocuments(request.text, request.mode, request.status);
+                break;
+            case RequestType::MATCH: {
+                const auto [words, status] = search_server_.MatchDocument(request.text, request.document_id);
+                response.words.assign(words.begin(), words.end());
+                response.status = status;
+                break;
+            }
+            case RequestType::ADD:
+                search_server_.AddDocument(request.document_id, request.text, request.status, request.ratings);
+                break;
+            case RequestType::REMOVE:
+                search_server_.RemoveDocument(request.document_id);
+                break;
+            case RequestType::STATS:
+                response.statistics = search_server_.GetCorpusStatistics(request.text);
+                break;
+            }
+        }
+        catch (const std::exception& e) {
+            response.ok = false;
+            response.error = e.what();
+        }
+        return response;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: "s << argv[0] << " <socket path | tcp:port> [--stop-words \"a b\"] [--corpus file] [--shard K/N] [--workers N] [--batch N] [--batch-window-us N]"s << std::endl;
+        return 1;
+    }
+    SearchDaemon::Options options;
+    options.address = argv[1];
+    for (int i = 2; i + 1 < argc; i += 2) {
+        const std::string_view name = argv[i];
+        if (name == "--stop-words"sv) {
+            options.stop_words = argv[i + 1];
+        }
+        else if (name == "--corpus"sv) {
+            options.corpus_path = argv[i + 1];
+        }
+        else if (name == "--shard"sv) {
+            const std::string shard = argv[i + 1];
+            const size_t slash = shard.find('/');
+            if (slash == std::string::npos) {
+                std::cerr << "Shard must be K/N"s << std::endl;
+                return 1;
+            }
+            options.shard = std::stoi(shard.substr(0, slash));
+            options.shard_count = std::stoi(shard.substr(slash + 1));
+            if (options.shard_count < 1 || options.shard < 0 || options.shard >= options.shard_count) {
+                std::cerr << "Shard must be K/N with 0 <= K < N"s << std::endl;
+                return 1;
+            }
+        }
+        else if (name == "--workers"sv) {
+            options.worker_count = std::max(1, std::stoi(argv[i + 1]));
+        }
+        else if (name == "--batch"sv) {
+            options.max_batch_size = std::max(1, std::stoi(argv[i + 1]));
+        }
+        else if (name == "--batch-window-us"sv) {
+            options.batch_window = std::chrono::microseconds(std::stoi(argv[i + 1]));
+        }
+        else {
+            std::cerr << "Unknown option "s << name << std::endl;
+            return 1;
+        }
+    }
+
+    std::signal(SIGINT, RequestStop);
+    std::signal(SIGTERM, RequestStop);
+    try {
+        SearchDaemon(options).Run();
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,270 @@
+#include <stdexcept>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "search_protocol.h"
+#include "binary_io.h"
+
+namespace {
+const size_t MAX_MESSAGE_SIZE = 64 << 20;
+
+// Returns the body of the first message or false if it is incomplete
+bool TakeFrame(std::string_view& data, std::string_view& body) {
+    std::string_view rest = data;
+    uint32_t size = 0;
+    if (!GetValue(rest, size)) return false;
+    if (size > MAX_MESSAGE_SIZE) throw std::invalid_argument("Message is too large");
+    if (rest.size() < size) return false;
+    body = rest.substr(0, size);
+    data = rest.substr(size);
+    return true;
+}
+
+void PutFrame(std::string& out, const std::string& body) {
+    PutValue(out, static_cast<uint32_t>(body.size()));
+    out += body;
+}
+
+void Check(bool decoded) {
+    if (!decoded) throw std::invalid_argument("Malformed message");
+}
+
+void PutStatistics(std::string& out, const CorpusStatistics& statistics) {
+    PutValue(out, statistics.document_count);
+    PutValue(out, static_cast<uint32_t>(statistics.word_document_counts.size()));
+    for (const auto& [word, document_count] : statistics.word_document_counts) {
+        PutString(out, word);
+        PutValue(out, document_count);
+    }
+}
+
+void GetStatistics(std::string_view& data, CorpusStatistics& statistics) {
+    uint32_t count = 0;
+    Check(GetValue(data, statistics.document_count) && GetValue(data, count));
+    statistics.word_document_counts.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string_view word;
+        int document_count = 0;
+        Check(GetString(data, word) && GetValue(data, document_count));
+        statistics.word_document_counts.emplace(word, document_count);
+    }
+}
+
+bool IsTcp(const std::string& address) {
+    return address.rfind("tcp:", 0) == 0;
+}
+
+sockaddr_in MakeLoopbackAddress(const std::string& address) {
+    sockaddr_in result{};
+    result.sin_family = AF_INET;
+    result.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    result.sin_port = htons(static_cast<uint16_t>(std::stoi(address.substr(4))));
+    return result;
+}
+
+sockaddr_un MakeUnixAddress(const std::string& address) {
+    sockaddr_un result{};
+    result.sun_family = AF_UNIX;
+    if (address.size() >= sizeof(result.sun_path)) throw std::invalid_argument("Socket path is too long");
+    address.copy(result.sun_path, address.size());
+    return result;
+}
+}
+
+void EncodeRequest(const Request& request, std::string& out) {
+    std::string body;
+    PutValue(body, request.request_id);
+    PutValue(body, request.type);
+    switch (request.type) {
+    case RequestType::FIND:
+        PutValue(body, request.status);
+        PutValue(body, request.mode);
+        PutString(body, request.text);
+        PutValue(body, static_cast<uint8_t>(request.statistics.has_value()));
+        if (request.statistics) PutStatistics(body, *request.statistics);
+        break;
+    case RequestType::MATCH:
+        PutValue(body, request.document_id);
+        PutString(body, request.text);
+        break;
+    case RequestType::ADD:
+        PutValue(body, request.document_id);
+        PutValue(body, request.status);
+        PutValue(body, static_cast<uint32_t>(request.ratings.size()));
+        for (const int rating : request.ratings) {
+            PutValue(body, rating);
+        }
+        PutString(body, request.text);
+        break;
+    case RequestType::REMOVE:
+        PutValue(body, request.document_id);
+        break;
+    case RequestType::STATS:
+        PutString(body, request.text);
+        break;
+    }
+    PutFrame(out, body);
+}
+
+bool DecodeRequest(std::string_view& data, Request& request) {
+    std::string_view body;
+    if (!TakeFrame(data, body)) return false;
+    std::string_view text;
+    Check(GetValue(body, request.request_id) && GetValue(body, request.type));
+    switch (request.type) {
+    case RequestType::FIND: {
+        uint8_t has_statistics = 0;
+        Check(GetValue(body, request.status) && GetValue(body, request.mode) && GetString(body, text) && GetValue(body, has_statistics));
+        request.statistics.reset();
+        if (has_statistics) GetStatistics(body, request.statistics.emplace());
+        break;
+    }
+    case RequestType::MATCH:
+        Check(GetValue(body, request.document_id) && GetString(body, text));
+        break;
+    case RequestType::ADD: {
+        uint32_t rating_count = 0;
+        Check(GetValue(body, request.document_id) && GetValue(body, request.status) && GetValue(body, rating_count));
+        Check(body.size() / sizeof(int) >= rating_count);
+        request.ratings.resize(rating_count);
+        for (int& rating : request.ratings) {
+            GetValue(body, rating);
+        }
+        Check(GetString(body, text));
+        break;
+    }
+    case RequestType::REMOVE:
+        Check(GetValue(body, request.document_id));
+        break;
+    case RequestType::STATS:
+        Check(GetString(body, text));
+        break;
+    default:
+        throw std::invalid_argument("Unknown request type");
+    }
+    Check(body.empty());
+    request.text = std::string(text);
+    return true;
+}
+
+void EncodeResponse(const Response& response, std::string& out) {
+    std::string body;
+    PutValue(body, response.request_id);
+    PutValue(body, response.type);
+    PutValue(body, static_cast<uint8_t>(response.ok));
+    if (!response.ok) {
+        PutString(body, response.error);
+    }
+    else if (response.type == RequestType::FIND) {
+        PutValue(body, static_cast<uint32_t>(response.documents.size()));
+        for (const Document& document : response.documents) {
+            PutValue(body, document.id);
+            PutValue(body, document.relevance);
+            PutValue(body, document.rating);
+        }
+    }
+    else if (response.type == RequestType::MATCH) {
+        PutValue(body, response.status);
+        PutValue(body, static_cast<uint32_t>(response.words.size()));
+        for (const std::string& word : response.words) {
+            PutString(body, word);
+        }
+    }
+    else if (response.type == RequestType::STATS) {
+        PutStatistics(body, response.statistics);
+    }
+    PutFrame(out, body);
+}
+
+bool DecodeResponse(std::string_view& data, Response& response) {
+    std::string_view body;
+    if (!TakeFrame(data, body)) return false;
+    uint8_t ok = 0;
+    Check(GetValue(body, response.request_id) && GetValue(body, response.type) && GetValue(body, ok));
+    response.ok = ok != 0;
+    response.documents.clear();
+    response.words.clear();
+    response.error.clear();
+    if (!response.ok) {
+        std::string_view error;
+        Check(GetString(body, error));
+        response.error = std::string(error);
+    }
+    else if (response.type == RequestType::FIND) {
+        uint32_t count = 0;
+        Check(GetValue(body, count));
+        for (uint32_t i = 0; i < count; ++i) {
+            Document document;
+            Check(GetValue(body, document.id) && GetValue(body, document.relevance) && GetValue(body, document.rating));
+            response.documents.push_back(document);
+        }
+    }
+    else if (response.type == RequestType::MATCH) {
+        uint32_t count = 0;
+        Check(GetValue(body, response.status) && GetValue(body, count));
+        for (uint32_t i = 0; i < count; ++i) {
+            std::string_view word;
+            Check(GetString(body, word));
+            response.words.emplace_back(word);
+        }
+    }
+    else if (response.type == RequestType::STATS) {
+        GetStatistics(body, response.statistics);
+    }
+    Check(body.empty());
+    return true;
+}
+
+int ListenSocket(const std::string& address) {
+    int fd = -1;
+    int bound = -1;
+    if (IsTcp(address)) {
+        // The address is parsed first, it throws on a bad one
+        const sockaddr_in socket_address = MakeLoopbackAddress(address);
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        const int enable = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+        bound = ::bind(fd, reinterpret_cast<const sockaddr*>(&socket_address), sizeof(socket_address));
+    }
+    else {
+        const sockaddr_un socket_address = MakeUnixAddress(address);
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        ::unlink(address.c_str());
+        bound = ::bind(fd, reinterpret_cast<const sockaddr*>(&socket_address), sizeof(socket_address));
+    }
+    if (fd < 0 || bound != 0) {
+        if (fd >= 0) ::close(fd);
+        throw std::runtime_error("Can't bind " + address);
+    }
+    if (::listen(fd, SOMAXCONN) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Can't listen on " + address);
+    }
+    return fd;
+}
+
+int ConnectSocket(const std::string& address) {
+    int fd = -1;
+    int connected = -1;
+    if (IsTcp(address)) {
+        const sockaddr_in socket_address = MakeLoopbackAddress(address);
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        connected = ::connect(fd, reinterpret_cast<const sockaddr*>(&socket_address), sizeof(socket_address));
+        const int enable = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+    else {
+        const sockaddr_un socket_address = MakeUnixAddress(address);
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        connected = ::connect(fd, reinterpret_cast<const sockaddr*>(&socket_address), sizeof(socket_address));
+    }
+    if (fd < 0 || connected != 0) {
+        if (fd >= 0) ::close(fd);
+        throw std::runtime_error("Can't connect to " + address);
+    }
+    return fd;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+// Binary protocol of the search daemon. Every message is framed as [body size][body],
+// requests may be pipelined and responses carry the id of their request
+enum class RequestType : uint8_t {
+    FIND = 1,
+    MATCH = 2,
+    ADD = 3,
+    REMOVE = 4,
+    // Document frequencies of the query words, first round of a distributed query
+    STATS = 5,
+};
+
+struct Request {
+    uint32_t request_id = 0;
+    RequestType type = RequestType::FIND;
+    int document_id = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    QueryMode mode = QueryMode::ANY;
+    std::vector<int> ratings;
+    // Query for FIND/MATCH/STATS, document text for ADD
+    std::string text;
+    // Global statistics a FIND is ranked with, local ones if absent
+    std::optional<CorpusStatistics> statistics;
+};
+
+struct Response {
+    uint32_t request_id = 0;
+    RequestType type = RequestType::FIND;
+    bool ok = true;
+    std::vector<Document> documents;
+    std::vector<std::string> words;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    CorpusStatistics statistics;
+    std::string error;
+};
+
+void EncodeRequest(const Request& request, std::string& out);
+void EncodeResponse(const Response& response, std::string& out);
+// Take one complete message off the front of data, return false if it is not fully received yet.
+// Throw std::invalid_argument on a malformed message
+bool DecodeRequest(std::string_view& data, Request& request);
+bool DecodeResponse(std::string_view& data, Response& response);
+
+// Address is either a Unix socket path or "tcp:<port>" for a loopback TCP port
+int ListenSocket(const std::string& address);
+int ConnectSocket(const std::string& address);
@@ -8,32 +8,119 @@
 #include <execution>
 #include <mutex>
 #include <future>
+#include <ostream>
 
 #include "search_server.h"
 #include "string_processing.h"
+#include "posting_intersection.h"
 
 
-SearchServer::SearchServer() = default;
-SearchServer::SearchServer(const std::string& stop_words_text) : SearchServer(SplitIntoWordsView(stop_words_text)) {}
-SearchServer::SearchServer(std::string_view stop_words_text) : SearchServer(SplitIntoWordsView(std::string(stop_words_text))) {}//SplitIntoWordsCache
+SearchServer::SearchServer(std::pmr::memory_resource* upstream) : index_memory_(std::make_unique<PoolMemory>(upstream)) {}
+SearchServer::SearchServer(const std::string& stop_words_text, std::pmr::memory_resource* upstream) : SearchServer(SplitIntoWordsView(stop_words_text), upstream) {}
+SearchServer::SearchServer(std::string_view stop_words_text, std::pmr::memory_resource* upstream) : SearchServer(SplitIntoWordsView(std::string(stop_words_text)), upstream) {}//SplitIntoWordsCache
 
 void SearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
+    CheckDocumentId(document_id);
+    auto storage = std::make_shared<const std::string>(document);
+    const PreparedDocument prepared = PrepareDocument(*storage, ratings);
+    CheckPreparedDocument(prepared);
+    // Logged before indexing, so a change visible to queries is always in the log
+    if (write_ahead_log_) write_ahead_log_->LogAddDocument(document_id, document, status, ratings);
+    IndexDocument(document_id, *storage, storage, status, prepared);
+}
+
+void SearchServer::AddDocuments(const std::vector<DocumentRecord>& documents, std::shared_ptr<const void> storage) {
+    std::vector<PreparedDocument> prepared(documents.size());
+    std::transform(
+        std::execution::par,
+        documents.begin(), documents.end(),
+        prepared.begin(),
+        [this](const DocumentRecord& document) {
+            return PrepareDocument(document.text, document.ratings);
+        }
+    );
+    for (size_t i = 0; i < documents.size(); ++i) {
+        const DocumentRecord& document = documents[i];
+        CheckDocumentId(document.id);
+        CheckPreparedDocument(prepared[i]);
+        if (write_ahead_log_) write_ahead_log_->LogAddDocument(document.id, document.text, document.status, document.ratings);
+        IndexDocument(document.id, document.text, storage, document.status, prepared[i]);
+    }
+}
 
-    //checks
+void SearchServer::CheckDocumentId(int document_id) const {
     if (document_id < 0) throw std::invalid_argument("ID less than zero");
     if (documents_.count(document_id) > 0) throw std::invalid_argument("ID is not exist");
+}
+
+void SearchServer::CheckPreparedDocument(const PreparedDocument& prepared) {
+    if (!prepared.is_valid) throw std::invalid_argument("Forbidden symbols");
+}
 
-    DocumentData document_data = { ComputeAverageRating(ratings), status, std::string(document) };
-    auto document_data_iter = documents_.emplace(document_id, document_data);
-    const std::vector<std::string_view> words = SplitIntoWordsNoStop((*document_data_iter.first).second.document);
+SearchServer::PreparedDocument SearchServer::PrepareDocument(std::string_view document, const std::vector<int>& ratings) const {
+    std::vector<std::string_view> words = SplitIntoWordsNoStop(document);
+    PreparedDocument result = { {}, ComputeAverageRating(ratings), std::all_of(words.begin(), words.end(), IsValidWord) };
+    if (!result.is_valid) return result;
     const double inv_word_count = 1.0 / words.size();
+    std::sort(words.begin(), words.end());
     for (std::string_view word : words) {
-        if (!IsValidWord(word)) throw std::invalid_argument("Forbidden symbols");
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        document_to_word_freqs_[document_id][word] += inv_word_count;
+        if (result.word_freqs.empty() || result.word_freqs.back().first != word) {
+            result.word_freqs.emplace_back(word, 0.0);
+        }
+        result.word_freqs.back().second += inv_word_count;
+    }
+    return result;
+}
+
+// The document must pass CheckDocumentId and CheckPreparedDocument
+void SearchServer::IndexDocument(int document_id, std::string_view document, std::shared_ptr<const void> storage, DocumentStatus status, const PreparedDocument& prepared) {
+    DocumentData& document_data = documents_[document_id];
+    document_data = { prepared.rating, status, document, std::move(storage), {}, next_sequence_ };
+    std::pmr::map<std::string_view, double>& word_freqs = document_to_word_freqs_[document_id];
+    for (const auto& [word, term_freq] : prepared.word_freqs) {
+        const int word_id = GetOrAddWordId(word);
+        word_to_document_freqs_[word_id][document_id] = term_freq;
+        word_freqs.emplace(word, term_freq);
+        document_data.word_ids.push_back(word_id);
+        ++word_document_counts_[word_id];
     }
+    std::sort(document_data.word_ids.begin(), document_data.word_ids.end());
     
     documents_index_.insert(document_id);
+    if (++next_sequence_ - mutable_segment_sequence_ >= MUTABLE_SEGMENT_DOCUMENT_COUNT) {
+        FreezeMutableSegment();
+    }
+}
+
+void SearchServer::FreezeMutableSegment() {
+    std::vector<IndexSegment::Posting> postings;
+    for (const auto& [word_id, document_freqs] : word_to_document_freqs_) {
+        for (const auto [document_id, term_freq] : document_freqs) {
+            postings.push_back({ word_id, document_id, documents_.at(document_id).sequence, term_freq });
+        }
+    }
+    if (!postings.empty()) {
+        segments_->Add(std::make_shared<const IndexSegment>(std::move(postings), segments_->IsImpactOrdered()));
+    }
+    word_to_document_freqs_.clear();
+    mutable_segment_sequence_ = next_sequence_;
+}
+
+void SearchServer::WaitForSegmentMerges() const {
+    segments_->WaitForMerges();
+}
+
+void SearchServer::SetImpactOrderedPostings(bool impact_ordered) {
+    segments_->SetImpactOrdered(impact_ordered);
+}
+
+AllocatorStatistics SearchServer::GetAllocatorStatistics() const {
+    return { index_memory_->GetNodeStatistics(), index_memory_->GetUpstreamStatistics(), QueryArena::GetStatistics(),
+        word_dictionary_.size(), word_dictionary_.GetMemoryUsage() };
+}
+
+void SearchServer::SetMinInverseDocumentFreq(double min_inverse_document_freq) {
+    min_inverse_document_freq_ = min_inverse_document_freq;
 }
 
 
@@ -48,8 +135,85 @@ std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query)
     return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
 }
 
-const std::map<std::string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    const static std::map<std::string_view, double> static_map;
+SearchResult SearchServer::FindTopDocumentsWithin(std::string_view raw_query, const SearchBudget& budget, DocumentStatus status) const {
+    return FindTopDocumentsWithin(
+        raw_query, budget, [status](int document_id, DocumentStatus document_status, int rating) {
+            return document_status == status;
+        });
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, QueryMode mode, DocumentStatus status) const {
+    return FindTopDocuments(
+        raw_query, mode, [status](int document_id, DocumentStatus document_status, int rating) {
+            return document_status == status;
+        });
+}
+
+QueryExplanation SearchServer::ExplainQuery(std::string_view raw_query, QueryMode mode) const {
+    QueryArena arena;
+    const QueryPlan plan = PlanQuery(ParseQuery(raw_query, mode));
+    auto explain = [](const std::pmr::vector<QueryTerm>& terms) {
+        std::vector<PlannedWord> words;
+        for (const QueryTerm& term : terms) {
+            words.push_back({ std::string(term.word), term.document_count, term.inverse_document_freq, term.is_required });
+        }
+        return words;
+    };
+    QueryExplanation result;
+    result.plus_words = explain(plan.plus_terms);
+    result.minus_words = explain(plan.minus_terms);
+    result.pruned_words = explain(plan.pruned_terms);
+    result.missing_words.assign(plan.missing_words.begin(), plan.missing_words.end());
+    result.is_empty = plan.is_empty;
+    if (plan.is_empty) return result;
+
+    const auto rarest_required = std::find_if(plan.plus_terms.begin(), plan.plus_terms.end(), [](const QueryTerm& term) {
+        return term.is_required;
+    });
+    if (rarest_required != plan.plus_terms.end()) {
+        // Intersection probes every other required list about once per candidate of the rarest one
+        const size_t required_count = std::count_if(plan.plus_terms.begin(), plan.plus_terms.end(), [](const QueryTerm& term) {
+            return term.is_required;
+        });
+        result.estimated_cost = static_cast<size_t>(rarest_required->document_count) * required_count;
+    }
+    else {
+        for (const std::pmr::vector<QueryTerm>* terms : { &plan.plus_terms, &plan.minus_terms }) {
+            for (const QueryTerm& term : *terms) {
+                result.estimated_cost += term.document_count;
+            }
+        }
+    }
+    return result;
+}
+
+CorpusStatistics SearchServer::GetCorpusStatistics(std::string_view raw_query) const {
+    QueryArena arena;
+    CorpusStatistics result;
+    result.document_count = GetDocumentCount();
+    for (std::string_view word : ParseQuery(raw_query).plus_words) {
+        const int word_id = FindWordId(word);
+        if (word_id != TermDictionary::NOT_FOUND && word_document_counts_[word_id] > 0) {
+            result.word_document_counts.emplace(word, word_document_counts_[word_id]);
+        }
+    }
+    return result;
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const CorpusStatistics& statistics, std::string_view raw_query, QueryMode mode, DocumentStatus status) const {
+    QueryArena arena;
+    Query query = ParseQuery(raw_query, mode);
+    query.statistics = &statistics;
+    std::vector<Document> matched_documents = FindAllDocuments(query,
+        [status](int document_id, DocumentStatus document_status, int rating) {
+            return document_status == status;
+        });
+    SelectTopDocuments(matched_documents);
+    return matched_documents;
+}
+
+const std::pmr::map<std::string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
+    const static std::pmr::map<std::string_view, double> static_map;
     if (!DocumeentExist(document_id)) return static_map;
     return document_to_word_freqs_.at(document_id);
 }
@@ -62,93 +226,121 @@ bool SearchServer::DocumeentExist(int document_id) const{
     return std::binary_search(documents_index_.begin(), documents_index_.end(), document_id);
 }
 
-std::set<int>::const_iterator SearchServer::begin() {
+std::pmr::set<int>::const_iterator SearchServer::begin() {
     return documents_index_.begin();
 }
 
-std::set<int>::const_iterator SearchServer::end() {
+std::pmr::set<int>::const_iterator SearchServer::end() {
     return documents_index_.end();
 }
 
+std::pmr::set<int>::const_iterator SearchServer::begin() const {
+    return documents_index_.begin();
+}
 
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::string& raw_query, int document_id) const {
-    Query query = ParseQuery(raw_query);
-
+std::pmr::set<int>::const_iterator SearchServer::end() const {
+    return documents_index_.end();
+}
 
-    std::vector<std::string_view> matched_words;
+std::string_view SearchServer::GetDocumentText(int document_id) const {
+    return documents_.at(document_id).document;
+}
 
+DocumentStatus SearchServer::GetDocumentStatus(int document_id) const {
+    return documents_.at(document_id).status;
+}
 
-    for (std::string_view word : query.minus_words) {
+int SearchServer::GetDocumentRating(int document_id) const {
+    return documents_.at(document_id).rating;
+}
 
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            return std::tuple{ std::vector<std::string_view> {}, documents_.at(document_id).status };
-            //matched_words.clear();
-            //break;
-        }
-    }
+void SearchServer::SetWriteAheadLog(WriteAheadLog* write_ahead_log) {
+    write_ahead_log_ = write_ahead_log;
+}
 
-    for (std::string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            matched_words.push_back(word);
-        }
-    }
 
-    return std::tuple{ matched_words, documents_.at(document_id).status };
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::string& raw_query, int document_id) const {
+    QueryArena arena;
+    return MatchResolvedQuery(ResolveQuery(ParseQuery(raw_query)), document_id);
 }
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::execution::sequenced_policy policy, const std::string& raw_query, int document_id) const {
     return MatchDocument(raw_query, document_id);
 }
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::execution::parallel_policy policy, const std::string& raw_query, int document_id) const {
-    Query query = ParseQuery(raw_query, true);
+    return MatchDocument(raw_query, document_id);
+}
 
-    if (std::any_of(
-        std::execution::par,
-        query.minus_words.begin(), query.minus_words.end(),
-        [&](std::string_view word) {
-            return word_to_document_freqs_.count(word) != 0 && word_to_document_freqs_.at(word).count(document_id) != 0;
-        }
-    )) {
-        return std::tuple{ std::vector<std::string_view> {}, documents_.at(document_id).status };
+std::vector<SearchServer::MatchResult> SearchServer::MatchDocuments(std::string_view raw_query, const std::vector<int>& document_ids) const {
+    QueryArena arena;
+    const WordIdQuery query = ResolveQuery(ParseQuery(raw_query));
+    // An exception escaping the parallel transform would terminate the program
+    for (const int document_id : document_ids) {
+        if (documents_.count(document_id) == 0) throw std::out_of_range("Unknown document id " + std::to_string(document_id));
     }
-
-    std::vector<std::string_view> matched_words(query.plus_words.size());
-
-    auto end_it = std::copy_if(
+    std::vector<MatchResult> result(document_ids.size());
+    std::transform(
         std::execution::par,
-        query.plus_words.begin(), query.plus_words.end(),
-        matched_words.begin(),
-        [&](std::string_view word) {
-            return word_to_document_freqs_.count(word) != 0 && word_to_document_freqs_.at(word).count(document_id) != 0;
+        document_ids.begin(), document_ids.end(),
+        result.begin(),
+        [this, &query](int document_id) {
+            return MatchResolvedQuery(query, document_id);
         }
     );
+    return result;
+}
 
-    matched_words.erase(end_it, matched_words.end());
+SearchServer::MatchResult SearchServer::MatchResolvedQuery(const WordIdQuery& query, int document_id) const {
+    const DocumentData& document_data = documents_.at(document_id);
 
-    std::sort(policy, matched_words.begin(), matched_words.end());
-    auto end_it2 = std::unique(policy, matched_words.begin(), matched_words.end());
-    matched_words.erase(end_it2, matched_words.end());
+    if (HasAnyWordId(query.minus_ids, document_data.word_ids)) {
+        return { std::vector<std::string_view>{}, document_data.status };
+    }
 
-    return std::tuple{ matched_words, documents_.at(document_id).status };
+    // Words are returned as parts of the document text, which lives as long as the document
+    const std::pmr::map<std::string_view, double>& word_freqs = document_to_word_freqs_.at(document_id);
+    std::vector<std::string_view> matched_words;
+    for (const size_t index : IntersectWordIds(query.plus_ids, document_data.word_ids)) {
+        matched_words.push_back(word_freqs.find(query.plus_words[index])->first);
+    }
+    std::sort(matched_words.begin(), matched_words.end());
+    return { matched_words, document_data.status };
+}
 
+std::vector<size_t> SearchServer::IntersectWordIds(const std::pmr::vector<int>& query_ids, const std::vector<int>& document_ids) {
+    std::vector<IntersectionMatch> matches;
+    IntersectGalloping(query_ids.data(), query_ids.size(), document_ids.data(), document_ids.size(), matches);
+    std::vector<size_t> result;
+    result.reserve(matches.size());
+    for (const auto& [query_index, _] : matches) {
+        result.push_back(query_index);
+    }
+    return result;
 }
 
+bool SearchServer::HasAnyWordId(const std::pmr::vector<int>& query_ids, const std::vector<int>& document_ids) {
+    return std::any_of(query_ids.begin(), query_ids.end(), [&document_ids](int word_id) {
+        return std::binary_search(document_ids.begin(), document_ids.end(), word_id);
+    });
+}
 
+bool SearchServer::HasAllWordIds(const std::pmr::vector<int>& query_ids, const std::vector<int>& document_ids) {
+    return std::all_of(query_ids.begin(), query_ids.end(), [&document_ids](int word_id) {
+        return std::binary_search(document_ids.begin(), document_ids.end(), word_id);
+    });
+}
 
 void SearchServer::RemoveDocument(int document_id) {
-    if (document_to_word_freqs_.count(document_id) == 0) return;
-    for (auto& [word_, freqs_]  : word_to_document_freqs_) {
-        //for (auto it = freqs_.begin(); it != freqs_.end(); ++it) {}
-        freqs_.erase(document_id);
-        //word_to_document_freqs_[word_] = freqs_;
+    const auto document_data = documents_.find(document_id);
+    if (document_data == documents_.end()) return;
+    if (write_ahead_log_) write_ahead_log_->LogRemoveDocument(document_id);
+    if (document_data->second.sequence >= mutable_segment_sequence_) {
+        for (const int word_id : document_data->second.word_ids) {
+            word_to_document_freqs_.at(word_id).erase(document_id);
+        }
     }
+    RemoveDocumentPostings(document_data->second, document_id);
     document_to_word_freqs_.erase(document_id);
-    documents_.erase(document_id);
+    documents_.erase(document_data);
     documents_index_.erase(document_id);
 }
 
@@ -156,40 +348,56 @@ void SearchServer::RemoveDocument(std::execution::sequenced_policy policy, int d
     RemoveDocument(document_id);
 }
 void SearchServer::RemoveDocument(std::execution::parallel_policy policy, int document_id) {
-    if (document_to_word_freqs_.count(document_id) == 0) return;
-
-    //std::map<std::string, double>& words_to_delete_map = document_to_word_freqs_[document_id];
-    std::vector<std::string_view> words_to_delete_vector(document_to_word_freqs_[document_id].size());
-
-    std::transform(
-        std::execution::par,
-        document_to_word_freqs_[document_id].begin(), document_to_word_freqs_[document_id].end(),
-        words_to_delete_vector.begin(),
-        [](const auto& val) { 
-            return val.first;
-        }
-    );
-
-
-    std::for_each(
-        std::execution::par,
-        words_to_delete_vector.begin(), words_to_delete_vector.end(),
-        [this, &document_id](const auto& word_to_delete) {
-            word_to_document_freqs_.at(word_to_delete).erase(document_id);
-        }
-    );
+    const auto document_data = documents_.find(document_id);
+    if (document_data == documents_.end()) return;
+    if (write_ahead_log_) write_ahead_log_->LogRemoveDocument(document_id);
+
+    if (document_data->second.sequence >= mutable_segment_sequence_) {
+        const std::vector<int>& word_ids = document_data->second.word_ids;
+        std::for_each(
+            std::execution::par,
+            word_ids.begin(), word_ids.end(),
+            [this, &document_id](int word_id) {
+                word_to_document_freqs_.at(word_id).erase(document_id);
+            }
+        );
+    }
 
+    RemoveDocumentPostings(document_data->second, document_id);
     document_to_word_freqs_.erase(document_id);
-    documents_.erase(document_id);
+    documents_.erase(document_data);
     documents_index_.erase(document_id);
 }
 
+// Postings of the mutable segment are erased by the caller
+void SearchServer::RemoveDocumentPostings(const DocumentData& document_data, int document_id) {
+    for (int word_id : document_data.word_ids) {
+        --word_document_counts_[word_id];
+    }
+    if (document_data.sequence < mutable_segment_sequence_) {
+        segments_->MarkRemoved(document_data.sequence);
+    }
+}
+
 
 bool SearchServer::IsStopWord(std::string_view word) const {
-    return stop_words_.count(std::string(word)) > 0;
+    return stop_words_.count(word) > 0;
+}
+
+int SearchServer::GetOrAddWordId(std::string_view word) {
+    const int found_id = FindWordId(word);
+    if (found_id != TermDictionary::NOT_FOUND) return found_id;
+    const int word_id = static_cast<int>(word_document_counts_.size());
+    word_document_counts_.push_back(0);
+    word_dictionary_.Insert(word, word_id);
+    return word_id;
+}
+
+int SearchServer::FindWordId(std::string_view word) const {
+    return word_dictionary_.Find(word);
 }
 
-std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(std::string_view text) {
+std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(std::string_view text) const {
     std::vector<std::string_view> words;
     for (std::string_view word : SplitIntoWordsView(text)) {
         if (!IsStopWord(word)) {
@@ -213,6 +421,10 @@ int SearchServer::ComputeAverageRating(const std::vector<int>& ratings) {
     return rating_sum / static_cast<int>(ratings.size());
 }
 
+void SearchServer::SelectTopDocuments(std::vector<Document>& documents) {
+    SelectTopDocuments(std::execution::seq, documents);
+}
+
 bool SearchServer::IsValidWord(std::string_view word) {
     // A valid word must not contain special characters
     return std::none_of(word.begin(), word.end(), [](char c) {
@@ -223,46 +435,171 @@ bool SearchServer::IsValidWord(std::string_view word) {
 
 SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view text) const {
     bool is_minus = false;
+    bool is_prefix = false;
+    bool is_required = false;
     size_t size = text.size();
     if (size == 0) throw std::invalid_argument("Empty text");
     if (!IsValidWord(text)) throw std::invalid_argument("Forbidden symbols");
 
-    if (text[0] == '-') {
+    if (text[0] == '+') {
+        if (size == 1) throw std::invalid_argument("Empty required word");
+        if (text[1] == '-' || text[1] == '+') throw std::invalid_argument("Forbidden required word");
+        is_required = true;
+        text = text.substr(1);
+    }
+    else if (text[0] == '-') {
         if (size == 1) throw std::invalid_argument("Empty minus word");
         if (text[1] == '-') throw std::invalid_argument("Forbidden minus word");
         is_minus = true;
         text = text.substr(1);
     }
-    return { text, is_minus, IsStopWord(text) };
+    if (text.back() == '*') {
+        if (text.size() == 1) throw std::invalid_argument("Empty prefix word");
+        if (is_required) throw std::invalid_argument("Required prefix word");
+        is_prefix = true;
+        text.remove_suffix(1);
+        return { text, is_minus, false, is_prefix, is_required };
+    }
+    return { text, is_minus, IsStopWord(text), is_prefix, is_required };
 }
 
-SearchServer::Query SearchServer::ParseQuery(std::string_view text, bool duplicates) const {
+SearchServer::Query SearchServer::ParseQuery(std::string_view text, QueryMode mode) const {
     Query result;
-    for (std::string_view word : SplitIntoWordsView(text)) {
+    for (std::string_view word : SplitIntoWordsView(text, QueryArena::GetResource())) {
         const QueryWord query_word = ParseQueryWord(word);
-        if (!query_word.is_stop) {
-            if (query_word.is_minus) {
-                result.minus_words.push_back(query_word.data);
-            }
-            else {
-                result.plus_words.push_back(query_word.data);
+        if (query_word.is_stop) continue;
+        std::pmr::vector<std::string_view>& words = query_word.is_minus ? result.minus_words : result.plus_words;
+        if (query_word.is_prefix) {
+            // Words left without documents by removals must not take the places of live ones
+            word_dictionary_.FindByPrefix(query_word.data, MAX_PREFIX_EXPANSION_COUNT,
+                [this](int word_id) { return word_document_counts_[word_id] > 0; },
+                [&](std::string_view word, int) { words.push_back(result.expanded_words.emplace_back(word)); });
+        }
+        else {
+            words.push_back(query_word.data);
+            if (!query_word.is_minus && (query_word.is_required || mode == QueryMode::ALL)) {
+                result.required_words.push_back(query_word.data);
             }
         }
     }
-    if (!duplicates) {
-        std::sort(result.minus_words.begin(), result.minus_words.end());
-        auto new_end_minus = std::unique(result.minus_words.begin(), result.minus_words.end());
-        result.minus_words.erase(new_end_minus, result.minus_words.end());
+    std::sort(result.required_words.begin(), result.required_words.end());
+    auto new_end_required = std::unique(result.required_words.begin(), result.required_words.end());
+    result.required_words.erase(new_end_required, result.required_words.end());
+
+    std::sort(result.minus_words.begin(), result.minus_words.end());
+    auto new_end_minus = std::unique(result.minus_words.begin(), result.minus_words.end());
+    result.minus_words.erase(new_end_minus, result.minus_words.end());
+
+    std::sort(result.plus_words.begin(), result.plus_words.end());
+    auto new_end_plus = std::unique(result.plus_words.begin(), result.plus_words.end());
+    result.plus_words.erase(new_end_plus, result.plus_words.end());
+    return result;
+}
 
-        std::sort(result.plus_words.begin(), result.plus_words.end());
-        auto new_end_plus = std::unique(result.plus_words.begin(), result.plus_words.end());
-        result.plus_words.erase(new_end_plus, result.plus_words.end());
+SearchServer::WordIdQuery SearchServer::ResolveQuery(const Query& query) const {
+    WordIdQuery result;
+    std::pmr::vector<std::pair<int, std::string_view>> plus_words(QueryArena::GetResource());
+    for (std::string_view word : query.plus_words) {
+        const int word_id = FindWordId(word);
+        if (word_id != TermDictionary::NOT_FOUND) plus_words.emplace_back(word_id, word);
+    }
+    std::sort(plus_words.begin(), plus_words.end());
+    // A word can come both as itself and from a prefix
+    plus_words.erase(std::unique(plus_words.begin(), plus_words.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.first == rhs.first;
+    }), plus_words.end());
+    for (const auto& [word_id, word] : plus_words) {
+        result.plus_ids.push_back(word_id);
+        result.plus_words.push_back(word);
+    }
+    for (std::string_view word : query.minus_words) {
+        const int word_id = FindWordId(word);
+        if (word_id != TermDictionary::NOT_FOUND) result.minus_ids.push_back(word_id);
     }
+    std::sort(result.minus_ids.begin(), result.minus_ids.end());
+    result.minus_ids.erase(std::unique(result.minus_ids.begin(), result.minus_ids.end()), result.minus_ids.end());
     return result;
 }
 
 
+SearchServer::QueryPlan SearchServer::PlanQuery(const Query& query) const {
+    QueryPlan plan;
+    for (std::string_view word : query.plus_words) {
+        const bool is_required = std::binary_search(query.required_words.begin(), query.required_words.end(), word);
+        const int word_id = FindWordId(word);
+        if (word_id == TermDictionary::NOT_FOUND || word_document_counts_[word_id] == 0) {
+            plan.missing_words.push_back(word);
+            if (is_required) {
+                // No document can match, the rest of the query is not looked up
+                plan.is_empty = true;
+                return plan;
+            }
+            continue;
+        }
+        plan.plus_terms.push_back({ word, word_id, word_document_counts_[word_id], ComputeWordInverseDocumentFreq(word, word_id, query.statistics), is_required });
+        if (is_required) plan.required_ids.push_back(word_id);
+    }
+    std::sort(plan.required_ids.begin(), plan.required_ids.end());
+    // Rare words have the shortest posting lists and narrow an intersection the most
+    std::stable_sort(plan.plus_terms.begin(), plan.plus_terms.end(), [](const QueryTerm& lhs, const QueryTerm& rhs) {
+        return lhs.document_count < rhs.document_count;
+    });
+    if (min_inverse_document_freq_ > 0 && !plan.plus_terms.empty()) {
+        const auto pruned = std::stable_partition(plan.plus_terms.begin() + 1, plan.plus_terms.end(), [this](const QueryTerm& term) {
+            return term.is_required || term.inverse_document_freq >= min_inverse_document_freq_;
+        });
+        plan.pruned_terms.assign(pruned, plan.plus_terms.end());
+        plan.plus_terms.erase(pruned, plan.plus_terms.end());
+    }
+    plan.is_empty = plan.plus_terms.empty();
+    if (plan.is_empty) return plan;
+
+    for (std::string_view word : query.minus_words) {
+        const int word_id = FindWordId(word);
+        if (word_id == TermDictionary::NOT_FOUND || word_document_counts_[word_id] == 0) {
+            plan.missing_words.push_back(word);
+            continue;
+        }
+        plan.minus_terms.push_back({ word, word_id, word_document_counts_[word_id], 0.0, false });
+        plan.minus_ids.push_back(word_id);
+    }
+    std::sort(plan.minus_ids.begin(), plan.minus_ids.end());
+    return plan;
+}
+
 // Existence required
-double SearchServer::ComputeWordInverseDocumentFreq(std::string_view word) const {
-    return std::log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
-}
\ No newline at end of file
+double SearchServer::ComputeWordInverseDocumentFreq(std::string_view word, int word_id, const CorpusStatistics* statistics) const {
+    if (statistics) {
+        const auto document_count = statistics->word_document_counts.find(word);
+        if (document_count != statistics->word_document_counts.end() && document_count->second > 0) {
+            return std::log(statistics->document_count * 1.0 / document_count->second);
+        }
+    }
+    return std::log(GetDocumentCount() * 1.0 / word_document_counts_[word_id]);
+}
+
+std::ostream& operator<<(std::ostream& output, const QueryExplanation& explanation) {
+    auto print_words = [&output](std::string_view title, const std::vector<PlannedWord>& words) {
+        output << title << ':';
+        for (const PlannedWord& word : words) {
+            output << ' ' << (word.is_required ? "+" : "") << word.word
+                << " (documents = " << word.document_count << ", idf = " << word.inverse_document_freq << ')';
+        }
+        output << '\n';
+    };
+    print_words("plus", explanation.plus_words);
+    print_words("minus", explanation.minus_words);
+    print_words("pruned", explanation.pruned_words);
+    output << "missing:";
+    for (const std::string& word : explanation.missing_words) {
+        output << ' ' << word;
+    }
+    output << '\n';
+    if (explanation.is_empty) {
+        output << "empty result, nothing to evaluate" << '\n';
+    }
+    else {
+        output << "estimated cost = " << explanation.estimated_cost << " postings" << '\n';
+    }
+    return output;
+}
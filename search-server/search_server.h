@@ -9,30 +9,130 @@
 #include <stdexcept>
 #include <execution>
 #include <atomic>
+#include <deque>
+#include <iosfwd>
+#include <memory>
+#include <memory_resource>
+#include <chrono>
+#include <limits>
+#include <queue>
+#include <unordered_map>
 
 #include "document.h"
 #include "string_processing.h"
 #include "concurrent_map.h"
+#include "term_dictionary.h"
+#include "write_ahead_log.h"
+#include "index_segment.h"
+#include "posting_intersection.h"
+#include "memory_resources.h"
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 const double DELTA = 1e-6;
+// Upper bound on words a single "prefix*" query word expands to
+const int MAX_PREFIX_EXPANSION_COUNT = 64;
+
+enum class QueryMode {
+    ANY,  // documents with any of the plus words, "+word" makes a word required
+    ALL,  // documents with all of the plus words (except prefix expansions)
+};
+
+// Limits of FindTopDocumentsWithin, the search stops at whichever is reached first
+struct SearchBudget {
+    std::chrono::steady_clock::duration time = std::chrono::steady_clock::duration::max();
+    size_t posting_count = std::numeric_limits<size_t>::max();
+};
+
+// Document frequencies of a corpus split between several servers
+struct CorpusStatistics {
+    int document_count = 0;
+    std::map<std::string, int, std::less<>> word_document_counts;
+};
+
+// Word of a query plan, document count is the one of this server
+struct PlannedWord {
+    std::string word;
+    int document_count = 0;
+    double inverse_document_freq = 0.0;
+    bool is_required = false;
+};
+
+// How SearchServer evaluates a query, see ExplainQuery
+struct QueryExplanation {
+    // In evaluation order, the rarest first
+    std::vector<PlannedWord> plus_words;
+    std::vector<PlannedWord> minus_words;
+    // Plus words skipped for an IDF below the threshold
+    std::vector<PlannedWord> pruned_words;
+    // Words no document contains
+    std::vector<std::string> missing_words;
+    // No document can match, nothing is evaluated
+    bool is_empty = false;
+    // Estimated number of postings read
+    size_t estimated_cost = 0;
+};
+
+std::ostream& operator<<(std::ostream& output, const QueryExplanation& explanation);
+
+struct AllocatorStatistics {
+    // Requests of the index containers to their pool and chunks the pool took from upstream
+    AllocationStatistics index_nodes;
+    AllocationStatistics index_upstream;
+    // Heap memory of the query arenas of all threads, shared by all servers
+    AllocationStatistics query_heap;
+    // Text and ids of the indexed words
+    size_t word_count = 0;
+    size_t word_dictionary_bytes = 0;
+};
+
+struct SearchResult {
+    std::vector<Document> documents;
+    // The budget ran out before all postings were processed
+    bool is_approximate = false;
+    size_t processed_posting_count = 0;
+};
 
 class SearchServer {
 public:
-    SearchServer();
+    using MatchResult = std::tuple<std::vector<std::string_view>, DocumentStatus>;
+
+    // Index containers allocate from a pool over upstream
+    explicit SearchServer(std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
 
     template <typename StringContainer>
-    explicit SearchServer(const StringContainer& stop_words);
-    explicit SearchServer(const std::string& stop_words_text);
-    explicit SearchServer(std::string_view stop_words_text);
+    explicit SearchServer(const StringContainer& stop_words, std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
+    explicit SearchServer(const std::string& stop_words_text, std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
+    explicit SearchServer(std::string_view stop_words_text, std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
 
     void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    // Splits documents into words in parallel and indexes them without copying the text: storage must keep it alive.
+    // Throws on the first invalid document, the ones before it stay added
+    void AddDocuments(const std::vector<DocumentRecord>& documents, std::shared_ptr<const void> storage);
     
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const;
     std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;
     std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
 
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, QueryMode mode, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, QueryMode mode, DocumentStatus status = DocumentStatus::ACTUAL) const;
+
+    // Processes postings from the highest impact down and returns the best documents found when the budget runs out.
+    // Frozen segments are traversed by impact only when built with SetImpactOrderedPostings
+    template <typename DocumentPredicate>
+    SearchResult FindTopDocumentsWithin(std::string_view raw_query, const SearchBudget& budget, DocumentPredicate document_predicate) const;
+    SearchResult FindTopDocumentsWithin(std::string_view raw_query, const SearchBudget& budget, DocumentStatus status = DocumentStatus::ACTUAL) const;
+
+    // Plan FindTopDocuments would use for the query
+    QueryExplanation ExplainQuery(std::string_view raw_query, QueryMode mode = QueryMode::ANY) const;
+
+    // Document count and frequencies of the query plus words (prefixes expanded) in this server
+    CorpusStatistics GetCorpusStatistics(std::string_view raw_query) const;
+    // Ranks with the given statistics instead of the local ones, so servers holding parts of a corpus
+    // score documents as one server holding all of it would
+    std::vector<Document> FindTopDocuments(const CorpusStatistics& statistics, std::string_view raw_query, QueryMode mode, DocumentStatus status = DocumentStatus::ACTUAL) const;
+
     template <typename DocumentPredicate, typename ExecutionPolicy>
     std::vector<Document> FindTopDocuments(ExecutionPolicy policy, std::string_view raw_query, DocumentPredicate document_predicate) const;
 
@@ -43,15 +143,37 @@ public:
     std::vector<Document> FindTopDocuments(ExecutionPolicy policy, std::string_view raw_query) const;
 
 
-    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+    const std::pmr::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
     int GetDocumentCount() const;
     bool DocumeentExist(int document_id) const;
-    std::set<int>::const_iterator begin();
-    std::set<int>::const_iterator end();
-
+    std::pmr::set<int>::const_iterator begin();
+    std::pmr::set<int>::const_iterator end();
+    std::pmr::set<int>::const_iterator begin() const;
+    std::pmr::set<int>::const_iterator end() const;
+    std::string_view GetDocumentText(int document_id) const;
+    DocumentStatus GetDocumentStatus(int document_id) const;
+    int GetDocumentRating(int document_id) const;
+
+    // AddDocument/RemoveDocument calls that pass validation are appended to the log before they are applied,
+    // nullptr detaches it
+    void SetWriteAheadLog(WriteAheadLog* write_ahead_log);
+    // Blocks until background merging of frozen segments settles
+    void WaitForSegmentMerges() const;
+    // Segments frozen or merged from now on also keep postings in descending impact order
+    void SetImpactOrderedPostings(bool impact_ordered);
+    AllocatorStatistics GetAllocatorStatistics() const;
+    // Optional plus words with a lower IDF are not evaluated, the rarest plus word always is. 0 keeps all words
+    void SetMinInverseDocumentFreq(double min_inverse_document_freq);
+
+    // Plus words of the query found in the document, sorted; none if it has a minus word.
+    // Throws std::out_of_range for an unknown document
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string& raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::execution::sequenced_policy policy, const std::string& raw_query, int document_id) const;
+    // Runs sequentially: intersecting one document is too cheap to split between threads, use MatchDocuments for batches
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::execution::parallel_policy policy, const std::string& raw_query, int document_id) const;
+    // Parses the query once and matches it against every document in parallel, same results as MatchDocument per id.
+    // Throws std::out_of_range before matching if any document is unknown
+    std::vector<MatchResult> MatchDocuments(std::string_view raw_query, const std::vector<int>& document_ids) const;
 
     void RemoveDocument(int document_id);
     void RemoveDocument(std::execution::sequenced_policy policy, int document_id);
@@ -61,47 +183,141 @@ private:
     struct DocumentData {
         int rating;
         DocumentStatus status;
-        std::string document;
+        std::string_view document;
+        // Owns the text: a copy made by AddDocument or a storage shared by many documents
+        std::shared_ptr<const void> storage;
+        // Sorted ids of the document words (forward index)
+        std::vector<int> word_ids;
+        // Order of addition, also tells whether the postings are still in the mutable segment
+        uint32_t sequence;
     };
     
-    const std::set<std::string> stop_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string_view, double>> document_to_word_freqs_;
-    std::map<int, DocumentData> documents_;
-    std::set<int> documents_index_;
+    const std::set<std::string, std::less<>> stop_words_;
+    // Declared before the containers allocating from it
+    std::unique_ptr<PoolMemory> index_memory_;
+    // Owns the text of every indexed word and maps it to the word id
+    TermDictionary word_dictionary_{ index_memory_->GetResource() };
+    // Number of documents containing each word id, over all segments
+    std::vector<int> word_document_counts_;
+    // Postings of the mutable segment by word id
+    std::pmr::map<int, std::pmr::map<int, double>> word_to_document_freqs_{ index_memory_->GetResource() };
+    uint32_t next_sequence_ = 0;
+    uint32_t mutable_segment_sequence_ = 0;
+    std::unique_ptr<SegmentSet> segments_ = std::make_unique<SegmentSet>();
+    // Keys point into the document text
+    std::pmr::map<int, std::pmr::map<std::string_view, double>> document_to_word_freqs_{ index_memory_->GetResource() };
+    std::pmr::map<int, DocumentData> documents_{ index_memory_->GetResource() };
+    std::pmr::set<int> documents_index_{ index_memory_->GetResource() };
+    WriteAheadLog* write_ahead_log_ = nullptr;
+    double min_inverse_document_freq_ = 0.0;
 
     bool IsStopWord(std::string_view word) const;
-    std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text);
+    std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text) const;
+
+    // Part of adding a document that doesn't touch the index and can run in parallel
+    struct PreparedDocument {
+        std::vector<std::pair<std::string_view, double>> word_freqs;
+        int rating;
+        bool is_valid;
+    };
+
+    PreparedDocument PrepareDocument(std::string_view document, const std::vector<int>& ratings) const;
+    void CheckDocumentId(int document_id) const;
+    static void CheckPreparedDocument(const PreparedDocument& prepared);
+    void IndexDocument(int document_id, std::string_view document, std::shared_ptr<const void> storage, DocumentStatus status, const PreparedDocument& prepared);
+    int GetOrAddWordId(std::string_view word);
+    int FindWordId(std::string_view word) const;
+    void FreezeMutableSegment();
+    void RemoveDocumentPostings(const DocumentData& document_data, int document_id);
     static int ComputeAverageRating(const std::vector<int>& ratings);
+    // Sorts by relevance, then rating, then id, and keeps MAX_RESULT_DOCUMENT_COUNT first
+    template <typename ExecutionPolicy>
+    static void SelectTopDocuments(ExecutionPolicy policy, std::vector<Document>& documents);
+    static void SelectTopDocuments(std::vector<Document>& documents);
     static bool IsValidWord(std::string_view word);
 
     struct QueryWord {
         std::string_view data;
         bool is_minus;
         bool is_stop;
+        bool is_prefix;
+        bool is_required;
     };
 
     QueryWord ParseQueryWord(std::string_view text) const;
 
+    // Query structures allocate from the arena of the current query
     struct Query {
-        std::vector<std::string_view> plus_words;
-        std::vector<std::string_view> minus_words;
+        std::pmr::vector<std::string_view> plus_words{ QueryArena::GetResource() };
+        std::pmr::vector<std::string_view> minus_words{ QueryArena::GetResource() };
+        // Subset of plus words a document must contain all of
+        std::pmr::vector<std::string_view> required_words{ QueryArena::GetResource() };
+        // Overrides the local document frequencies when set
+        const CorpusStatistics* statistics = nullptr;
+        // Words expanded from prefixes, the dictionary doesn't keep them as whole strings
+        std::pmr::deque<std::pmr::string> expanded_words{ QueryArena::GetResource() };
     };
 
-    Query ParseQuery(std::string_view text, bool duplicates = false) const;
+    Query ParseQuery(std::string_view text, QueryMode mode = QueryMode::ANY) const;
+
+    struct WordIdQuery {
+        std::pmr::vector<int> plus_ids{ QueryArena::GetResource() };
+        // Text of each of plus_ids
+        std::pmr::vector<std::string_view> plus_words{ QueryArena::GetResource() };
+        std::pmr::vector<int> minus_ids{ QueryArena::GetResource() };
+    };
+
+    // Drops unknown words, ids are sorted and unique
+    WordIdQuery ResolveQuery(const Query& query) const;
+
+    struct QueryTerm {
+        std::string_view word;
+        int word_id;
+        int document_count;
+        double inverse_document_freq;
+        bool is_required;
+    };
+
+    struct QueryPlan {
+        // Words present in the index, the rarest first
+        std::pmr::vector<QueryTerm> plus_terms{ QueryArena::GetResource() };
+        std::pmr::vector<QueryTerm> minus_terms{ QueryArena::GetResource() };
+        std::pmr::vector<QueryTerm> pruned_terms{ QueryArena::GetResource() };
+        std::pmr::vector<std::string_view> missing_words{ QueryArena::GetResource() };
+        // Sorted ids of the required plus terms and of the minus terms
+        std::pmr::vector<int> required_ids{ QueryArena::GetResource() };
+        std::pmr::vector<int> minus_ids{ QueryArena::GetResource() };
+        bool is_empty = false;
+    };
+
+    // Looks up document frequencies once, drops missing words and orders the rest by cost.
+    // Stops at the first missing required word
+    QueryPlan PlanQuery(const Query& query) const;
+    MatchResult MatchResolvedQuery(const WordIdQuery& query, int document_id) const;
+    // Positions in query_ids of the ids the document has
+    static std::vector<size_t> IntersectWordIds(const std::pmr::vector<int>& query_ids, const std::vector<int>& document_ids);
+    static bool HasAnyWordId(const std::pmr::vector<int>& query_ids, const std::vector<int>& document_ids);
+    static bool HasAllWordIds(const std::pmr::vector<int>& query_ids, const std::vector<int>& document_ids);
     // Existence required
-    double ComputeWordInverseDocumentFreq(std::string_view word) const;
+    double ComputeWordInverseDocumentFreq(std::string_view word, int word_id, const CorpusStatistics* statistics) const;
+    // Calls callback(document_id, term_freq, document_data) for every live posting of the word in every segment
+    template <typename Callback>
+    void ForEachPosting(const SegmentSet::Segments& segments, int word_id, Callback callback) const;
     template <typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const;
     template<typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(std::execution::parallel_policy policy, const Query& query, DocumentPredicate document_predicate) const;
     template<typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(std::execution::sequenced_policy policy, const Query& query, DocumentPredicate document_predicate) const;
+    // Intersects postings of the required words from the rarest one and scores only the documents left
+    template <typename DocumentPredicate>
+    std::vector<Document> FindAllConjunctiveDocuments(const QueryPlan& plan, DocumentPredicate document_predicate) const;
 };
 
 template <typename StringContainer>
-SearchServer::SearchServer(const StringContainer& stop_words)
-    : stop_words_(MakeUniqueNonEmptyStrings(stop_words)) {
+SearchServer::SearchServer(const StringContainer& stop_words, std::pmr::memory_resource* upstream)
+    : stop_words_(MakeUniqueNonEmptyStrings(stop_words))
+    , index_memory_(std::make_unique<PoolMemory>(upstream)) {
     for (const auto& word : stop_words) {
         if (!IsValidWord(word)) throw std::invalid_argument("Forbidden symbols");
     }
@@ -109,44 +325,137 @@ SearchServer::SearchServer(const StringContainer& stop_words)
 
 template <typename DocumentPredicate, typename ExecutionPolicy>
 std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy policy, std::string_view raw_query, DocumentPredicate document_predicate) const {
-
+    QueryArena arena;
     Query query = ParseQuery(raw_query);
     std::vector<Document> matched_documents = FindAllDocuments(policy, query, document_predicate);
+    SelectTopDocuments(policy, matched_documents);
+    return matched_documents;
+}
 
-    std::sort(policy,matched_documents.begin(), matched_documents.end(),
+template <typename ExecutionPolicy>
+void SearchServer::SelectTopDocuments(ExecutionPolicy policy, std::vector<Document>& documents) {
+    std::sort(policy, documents.begin(), documents.end(),
         [](const Document& lhs, const Document& rhs) {
             if (std::abs(lhs.relevance - rhs.relevance) < DELTA) {
-                return lhs.rating > rhs.rating;
+                // Ids make the order of equal documents the same on every path
+                return lhs.rating != rhs.rating ? lhs.rating > rhs.rating : lhs.id < rhs.id;
             }
             else {
                 return lhs.relevance > rhs.relevance;
             }
         });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+    if (documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
+        documents.resize(MAX_RESULT_DOCUMENT_COUNT);
     }
-    return matched_documents;
 }
 
 
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const {
-    Query query = ParseQuery(raw_query);
+    return FindTopDocuments(raw_query, QueryMode::ANY, document_predicate);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, QueryMode mode, DocumentPredicate document_predicate) const {
+    QueryArena arena;
+    Query query = ParseQuery(raw_query, mode);
     std::vector<Document> matched_documents = FindAllDocuments(query, document_predicate);
+    SelectTopDocuments(matched_documents);
+    return matched_documents;
+}
 
-    std::sort(matched_documents.begin(), matched_documents.end(),
-        [](const Document& lhs, const Document& rhs) {
-            if (std::abs(lhs.relevance - rhs.relevance) < DELTA) {
-                return lhs.rating > rhs.rating;
+template <typename DocumentPredicate>
+SearchResult SearchServer::FindTopDocumentsWithin(std::string_view raw_query, const SearchBudget& budget, DocumentPredicate document_predicate) const {
+    const auto start = std::chrono::steady_clock::now();
+    QueryArena arena;
+    const QueryPlan plan = PlanQuery(ParseQuery(raw_query));
+    SearchResult result;
+    if (plan.is_empty) return result;
+    const SegmentSet::Segments segments = segments_->GetSegments();
+
+    // One cursor per word and segment walks its postings from the highest term frequency down
+    struct Cursor {
+        IndexSegment::Postings postings;
+        double inverse_document_freq;
+        size_t position;
+        bool check_sequence;
+
+        size_t GetIndex() const {
+            return postings.impact_order ? postings.impact_order[position] : position;
+        }
+        double GetImpact() const {
+            return postings.term_freqs[GetIndex()] * inverse_document_freq;
+        }
+    };
+    std::pmr::vector<Cursor> cursors(QueryArena::GetResource());
+    // Postings of the mutable segment are sorted here, it is small
+    std::pmr::vector<std::pmr::vector<int>> mutable_ids(QueryArena::GetResource());
+    std::pmr::vector<std::pmr::vector<double>> mutable_freqs(QueryArena::GetResource());
+    for (const QueryTerm& term : plan.plus_terms) {
+        const double inverse_document_freq = term.inverse_document_freq;
+        const auto document_freqs = word_to_document_freqs_.find(term.word_id);
+        if (document_freqs != word_to_document_freqs_.end() && !document_freqs->second.empty()) {
+            std::pmr::vector<std::pair<double, int>> postings(QueryArena::GetResource());
+            for (const auto [document_id, term_freq] : document_freqs->second) {
+                postings.emplace_back(term_freq, document_id);
             }
-            else {
-                return lhs.relevance > rhs.relevance;
+            std::sort(postings.begin(), postings.end(), std::greater<>());
+            std::pmr::vector<int>& ids = mutable_ids.emplace_back();
+            std::pmr::vector<double>& freqs = mutable_freqs.emplace_back();
+            for (const auto& [term_freq, document_id] : postings) {
+                ids.push_back(document_id);
+                freqs.push_back(term_freq);
             }
-        });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+            cursors.push_back({ { ids.data(), nullptr, freqs.data(), ids.size(), nullptr }, inverse_document_freq, 0, false });
+        }
+        for (const auto& segment : segments) {
+            const IndexSegment::Postings postings = segment->FindPostings(term.word_id);
+            if (postings.size > 0) cursors.push_back({ postings, inverse_document_freq, 0, true });
+        }
     }
-    return matched_documents;
+
+    auto lower_impact = [&cursors](size_t lhs, size_t rhs) {
+        return cursors[lhs].GetImpact() < cursors[rhs].GetImpact();
+    };
+    std::priority_queue<size_t, std::pmr::vector<size_t>, decltype(lower_impact)> queue(lower_impact, std::pmr::vector<size_t>(QueryArena::GetResource()));
+    for (size_t i = 0; i < cursors.size(); ++i) {
+        queue.push(i);
+    }
+
+    // Clock is checked once per this many postings
+    const size_t CLOCK_CHECK_INTERVAL = 64;
+    std::pmr::unordered_map<int, double> document_to_relevance(QueryArena::GetResource());
+    while (!queue.empty()) {
+        if (result.processed_posting_count >= budget.posting_count
+            || (result.processed_posting_count % CLOCK_CHECK_INTERVAL == 0 && std::chrono::steady_clock::now() - start >= budget.time)) {
+            result.is_approximate = true;
+            break;
+        }
+        const size_t cursor_index = queue.top();
+        queue.pop();
+        Cursor& cursor = cursors[cursor_index];
+        const size_t index = cursor.GetIndex();
+        const int document_id = cursor.postings.document_ids[index];
+        const auto document_data = documents_.find(document_id);
+        if (document_data != documents_.end()
+            && (!cursor.check_sequence || document_data->second.sequence == cursor.postings.sequences[index])
+            && document_predicate(document_id, document_data->second.status, document_data->second.rating)) {
+            document_to_relevance[document_id] += cursor.postings.term_freqs[index] * cursor.inverse_document_freq;
+        }
+        ++result.processed_posting_count;
+        if (++cursor.position < cursor.postings.size) queue.push(cursor_index);
+    }
+
+    // Required and minus words are checked through the forward index so they don't use the budget
+    result.documents.reserve(document_to_relevance.size());
+    for (const auto [document_id, relevance] : document_to_relevance) {
+        const DocumentData& document_data = documents_.at(document_id);
+        if (HasAllWordIds(plan.required_ids, document_data.word_ids) && !HasAnyWordId(plan.minus_ids, document_data.word_ids)) {
+            result.documents.push_back({ document_id, relevance, document_data.rating });
+        }
+    }
+    SelectTopDocuments(result.documents);
+    return result;
 }
 
 
@@ -166,33 +475,54 @@ std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy policy, std
     return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
 }
 
+template <typename Callback>
+void SearchServer::ForEachPosting(const SegmentSet::Segments& segments, int word_id, Callback callback) const {
+    const auto mutable_postings = word_to_document_freqs_.find(word_id);
+    if (mutable_postings != word_to_document_freqs_.end()) {
+        for (const auto [document_id, term_freq] : mutable_postings->second) {
+            callback(document_id, term_freq, documents_.at(document_id));
+        }
+    }
+    for (const auto& segment : segments) {
+        const IndexSegment::Postings postings = segment->FindPostings(word_id);
+        for (size_t i = 0; i < postings.size; ++i) {
+            // Frozen segments keep postings of removed documents until they are merged
+            const auto document_data = documents_.find(postings.document_ids[i]);
+            if (document_data != documents_.end() && document_data->second.sequence == postings.sequences[i]) {
+                callback(postings.document_ids[i], postings.term_freqs[i], document_data->second);
+            }
+        }
+    }
+}
+
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindAllDocuments(const Query& query,
     DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (std::string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
+    const QueryPlan plan = PlanQuery(query);
+    if (plan.is_empty) {
+        return {};
+    }
+    if (!query.required_words.empty()) {
+        return FindAllConjunctiveDocuments(plan, document_predicate);
+    }
+    const SegmentSet::Segments segments = segments_->GetSegments();
+    std::pmr::map<int, double> document_to_relevance(QueryArena::GetResource());
+    for (const QueryTerm& term : plan.plus_terms) {
+        ForEachPosting(segments, term.word_id, [&](int document_id, double term_freq, const DocumentData& document_data) {
             if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+                document_to_relevance[document_id] += term_freq * term.inverse_document_freq;
             }
-        }
+        });
     }
 
-    for (std::string_view word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
+    for (const QueryTerm& term : plan.minus_terms) {
+        ForEachPosting(segments, term.word_id, [&](int document_id, double, const DocumentData&) {
             document_to_relevance.erase(document_id);
-        }
+        });
     }
 
     std::vector<Document> matched_documents;
+    matched_documents.reserve(document_to_relevance.size());
     for (const auto [document_id, relevance] : document_to_relevance) {
         matched_documents.push_back(
             { document_id, relevance, documents_.at(document_id).rating });
@@ -205,50 +535,140 @@ std::vector<Document> SearchServer::FindAllDocuments(
     std::execution::parallel_policy policy,
     const Query& query,
     DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(10000);
-
+    const QueryPlan plan = PlanQuery(query);
+    if (plan.is_empty) {
+        return {};
+    }
+    if (!query.required_words.empty()) {
+        return FindAllConjunctiveDocuments(plan, document_predicate);
+    }
+    const SegmentSet::Segments segments = segments_->GetSegments();
+    size_t expected_document_count = 0;
+    for (const QueryTerm& term : plan.plus_terms) {
+        expected_document_count += term.document_count;
+    }
+    ConcurrentMap<int, double> document_to_relevance(
+        std::min(expected_document_count, documents_.size()), ConcurrentMap<int, double>::GetDefaultShardCount(), QueryArena::GetResource());
 
     std::for_each(
         std::execution::par,
-        query.plus_words.begin(), query.plus_words.end(),
-        [&](const auto& word) {
-            if (word_to_document_freqs_.count(word) != 0) {
-                const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-                std::for_each(
-                    std::execution::seq,
-                    word_to_document_freqs_.at(word).begin(), word_to_document_freqs_.at(word).end(),
-                    [&](const auto& map) {
-                        const auto& [document_id, term_freq] = map;
-                        const auto& document_data = documents_.at(document_id);
-                        if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                            document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
-                        }
-                    }
-                );
-            }
+        plan.plus_terms.begin(), plan.plus_terms.end(),
+        [&](const QueryTerm& term) {
+            ForEachPosting(segments, term.word_id, [&](int document_id, double term_freq, const DocumentData& document_data) {
+                if (document_predicate(document_id, document_data.status, document_data.rating)) {
+                    document_to_relevance.Add(document_id, term_freq * term.inverse_document_freq);
+                }
+            });
         });
 
-
+    // Erase takes a lock, so no par_unseq here
     std::for_each(
-        std::execution::par_unseq,
-        query.minus_words.begin(), query.minus_words.end(),
-        [&](const auto& word) {
-            if (word_to_document_freqs_.count(word) != 0) {
-                for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                    document_to_relevance.erase(document_id);
-                }
-            }
+        std::execution::par,
+        plan.minus_terms.begin(), plan.minus_terms.end(),
+        [&](const QueryTerm& term) {
+            ForEachPosting(segments, term.word_id, [&](int document_id, double, const DocumentData&) {
+                document_to_relevance.Erase(document_id);
+            });
         });
 
     std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance.BuildOrdinaryMap()) {
+    matched_documents.reserve(document_to_relevance.GetSize());
+    document_to_relevance.ForEach([&](int document_id, double relevance) {
         matched_documents.push_back(
             { document_id, relevance, documents_.at(document_id).rating });
-    }
+    });
     return matched_documents;
 }
 
 template<typename DocumentPredicate>
 std::vector<Document> SearchServer::FindAllDocuments(std::execution::sequenced_policy policy, const Query& query, DocumentPredicate document_predicate) const {
     return FindAllDocuments(query, document_predicate);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllConjunctiveDocuments(const QueryPlan& plan, DocumentPredicate document_predicate) const {
+    // The plan keeps the rarest words first
+    std::pmr::vector<QueryTerm> required_words(QueryArena::GetResource());
+    std::pmr::vector<QueryTerm> optional_words(QueryArena::GetResource());
+    for (const QueryTerm& term : plan.plus_terms) {
+        (term.is_required ? required_words : optional_words).push_back(term);
+    }
+    const std::pmr::vector<int>& minus_ids = plan.minus_ids;
+
+    std::pmr::vector<Document> matched_documents(QueryArena::GetResource());
+    std::vector<IntersectionMatch> matches;
+    // Every live document has its postings in exactly one segment, so segments are intersected separately
+    auto intersect_segment = [&](auto get_postings, bool check_sequence) {
+        std::pmr::vector<int> candidate_ids(QueryArena::GetResource());
+        std::pmr::vector<uint32_t> candidate_sequences(QueryArena::GetResource());
+        std::pmr::vector<double> candidate_relevance(QueryArena::GetResource());
+        for (size_t i = 0; i < required_words.size(); ++i) {
+            const IndexSegment::Postings postings = get_postings(required_words[i]);
+            const double inverse_document_freq = required_words[i].inverse_document_freq;
+            if (i == 0) {
+                candidate_ids.assign(postings.document_ids, postings.document_ids + postings.size);
+                candidate_sequences.assign(postings.sequences, postings.sequences + postings.size);
+                for (size_t j = 0; j < postings.size; ++j) {
+                    candidate_relevance.push_back(postings.term_freqs[j] * inverse_document_freq);
+                }
+                continue;
+            }
+            matches.clear();
+            IntersectSorted(candidate_ids.data(), candidate_ids.size(), postings.document_ids, postings.size, matches);
+            for (size_t j = 0; j < matches.size(); ++j) {
+                const auto [candidate, posting] = matches[j];
+                candidate_ids[j] = candidate_ids[candidate];
+                candidate_sequences[j] = candidate_sequences[candidate];
+                candidate_relevance[j] = candidate_relevance[candidate] + postings.term_freqs[posting] * inverse_document_freq;
+            }
+            candidate_ids.resize(matches.size());
+            candidate_sequences.resize(matches.size());
+            candidate_relevance.resize(matches.size());
+            if (candidate_ids.empty()) return;
+        }
+
+        for (size_t i = 0; i < candidate_ids.size(); ++i) {
+            const int document_id = candidate_ids[i];
+            const auto document_data = documents_.find(document_id);
+            if (document_data == documents_.end() || (check_sequence && document_data->second.sequence != candidate_sequences[i])) continue;
+            const DocumentData& data = document_data->second;
+            if (!document_predicate(document_id, data.status, data.rating)) continue;
+            if (HasAnyWordId(minus_ids, data.word_ids)) continue;
+
+            double relevance = candidate_relevance[i];
+            const std::pmr::map<std::string_view, double>& word_freqs = document_to_word_freqs_.at(document_id);
+            for (const QueryTerm& term : optional_words) {
+                const auto word_freq = word_freqs.find(term.word);
+                if (word_freq != word_freqs.end()) {
+                    relevance += word_freq->second * term.inverse_document_freq;
+                }
+            }
+            matched_documents.push_back({ document_id, relevance, data.rating });
+        }
+    };
+
+    // Postings of the mutable segment are copied into flat arrays to share the intersection code
+    std::pmr::vector<std::pmr::vector<int>> mutable_ids(required_words.size(), QueryArena::GetResource());
+    std::pmr::vector<std::pmr::vector<double>> mutable_freqs(required_words.size(), QueryArena::GetResource());
+    for (size_t i = 0; i < required_words.size(); ++i) {
+        const auto document_freqs = word_to_document_freqs_.find(required_words[i].word_id);
+        if (document_freqs == word_to_document_freqs_.end()) continue;
+        for (const auto [document_id, term_freq] : document_freqs->second) {
+            mutable_ids[i].push_back(document_id);
+            mutable_freqs[i].push_back(term_freq);
+        }
+    }
+    const std::pmr::vector<uint32_t> no_sequences(std::max_element(mutable_ids.begin(), mutable_ids.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.size() < rhs.size(); })->size(), QueryArena::GetResource());
+    intersect_segment([&](const QueryTerm& required_word) {
+        const size_t index = &required_word - required_words.data();
+        return IndexSegment::Postings{ mutable_ids[index].data(), no_sequences.data(), mutable_freqs[index].data(), mutable_ids[index].size(), nullptr };
+    }, false);
+
+    for (const auto& segment : segments_->GetSegments()) {
+        intersect_segment([&segment](const QueryTerm& required_word) {
+            return segment->FindPostings(required_word.word_id);
+        }, true);
+    }
+    return { matched_documents.begin(), matched_documents.end() };
 }
\ No newline at end of file
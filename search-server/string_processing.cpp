@@ -1,7 +1,8 @@
 #include <string_view>
 #include "string_processing.h"
-std::vector<std::string_view> SplitIntoWordsView(std::string_view text) {
-    std::vector<std::string_view> words;
+namespace {
+template <typename Words>
+void SplitIntoWordsView(std::string_view text, Words& words) {
     std::string_view::iterator begin = text.begin();
     std::ptrdiff_t i = 0;
     for (const char c : text) {
@@ -20,6 +21,17 @@ std::vector<std::string_view> SplitIntoWordsView(std::string_view text) {
     if (i != 0) {
         words.push_back(std::string_view(&(*begin), i));
     }
+}
+}
+
+std::vector<std::string_view> SplitIntoWordsView(std::string_view text) {
+    std::vector<std::string_view> words;
+    SplitIntoWordsView(text, words);
+    return words;
+}
 
+std::pmr::vector<std::string_view> SplitIntoWordsView(std::string_view text, std::pmr::memory_resource* resource) {
+    std::pmr::vector<std::string_view> words(resource);
+    SplitIntoWordsView(text, words);
     return words;
 }
\ No newline at end of file
@@ -2,11 +2,14 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <functional>
+#include <memory_resource>
 std::vector<std::string_view> SplitIntoWordsView(std::string_view text);
+std::pmr::vector<std::string_view> SplitIntoWordsView(std::string_view text, std::pmr::memory_resource* resource);
 
 template <typename StringContainer>
-std::set<std::string> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
-    std::set<std::string> non_empty_strings;
+std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
+    std::set<std::string, std::less<>> non_empty_strings;
     for (const auto& str : strings) {
         if (!str.empty()) {
             non_empty_strings.insert(std::string(str));
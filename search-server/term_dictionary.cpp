@@ -0,0 +1,225 @@
+#include <algorithm>
+
+#include "term_dictionary.h"
+
+namespace {
+void WriteVarint(std::vector<char>& data, uint32_t value) {
+    while (value >= 0x80) {
+        data.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    data.push_back(static_cast<char>(value));
+}
+
+uint32_t ReadVarint(const char*& pos) {
+    uint32_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        const auto byte = static_cast<unsigned char>(*pos++);
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return value;
+    }
+}
+
+size_t CountCommonPrefix(std::string_view lhs, std::string_view rhs) {
+    const size_t max_size = std::min(lhs.size(), rhs.size());
+    return std::mismatch(lhs.begin(), lhs.begin() + max_size, rhs.begin()).first - lhs.begin();
+}
+}
+
+// Decodes words in order from the first word of a block to the end of the dictionary
+class TermDictionary::Reader {
+public:
+    Reader(const TermDictionary& dictionary, size_t block)
+        : dictionary_(dictionary)
+        , pos_(block < dictionary.block_offsets_.size() ? dictionary.data_.data() + dictionary.block_offsets_[block] : nullptr)
+        , index_(std::min(block * BLOCK_SIZE, dictionary.ids_.size())) {}
+
+    bool Next() {
+        if (index_ == dictionary_.ids_.size()) return false;
+        const uint32_t shared = index_ % BLOCK_SIZE == 0 ? 0 : ReadVarint(pos_);
+        const uint32_t suffix = ReadVarint(pos_);
+        word_.resize(shared);
+        word_.append(pos_, suffix);
+        pos_ += suffix;
+        id_ = dictionary_.ids_[index_++];
+        return true;
+    }
+
+    std::string_view word() const { return word_; }
+    int id() const { return id_; }
+
+private:
+    const TermDictionary& dictionary_;
+    const char* pos_;
+    size_t index_;
+    std::string word_;
+    int id_ = NOT_FOUND;
+};
+
+// Appends sorted words to the blocks
+class TermDictionary::Writer {
+public:
+    explicit Writer(TermDictionary& dictionary)
+        : dictionary_(dictionary) {}
+
+    void Append(std::string_view word, int id) {
+        std::vector<char>& data = dictionary_.data_;
+        if (dictionary_.ids_.size() % BLOCK_SIZE == 0) {
+            dictionary_.block_offsets_.push_back(static_cast<uint32_t>(data.size()));
+            WriteVarint(data, static_cast<uint32_t>(word.size()));
+            data.insert(data.end(), word.begin(), word.end());
+        }
+        else {
+            const size_t shared = CountCommonPrefix(word, previous_);
+            WriteVarint(data, static_cast<uint32_t>(shared));
+            WriteVarint(data, static_cast<uint32_t>(word.size() - shared));
+            data.insert(data.end(), word.begin() + shared, word.end());
+        }
+        dictionary_.ids_.push_back(id);
+        previous_ = word;
+    }
+
+private:
+    TermDictionary& dictionary_;
+    std::string previous_;
+};
+
+TermDictionary::TermDictionary(std::pmr::memory_resource* resource)
+    : new_words_(resource) {}
+
+int TermDictionary::Find(std::string_view word) const {
+    const int id = FindEncoded(word);
+    if (id != NOT_FOUND) return id;
+    const auto it = new_words_.find(word);
+    return it == new_words_.end() ? NOT_FOUND : it->second;
+}
+
+void TermDictionary::Insert(std::string_view word, int id) {
+    new_words_.emplace(word, id);
+    // Rebuilding once new words reach a fixed share of the dictionary keeps the cost amortized
+    if (new_words_.size() > std::max<size_t>(64, ids_.size() / 4)) {
+        Rebuild();
+    }
+}
+
+void TermDictionary::FindByPrefix(std::string_view prefix, size_t limit, const std::function<bool(int)>& accept,
+                                  const std::function<void(std::string_view, int)>& callback) const {
+    // Both sources are sorted, so they are merged to keep the word order
+    Reader reader(*this, block_offsets_.empty() ? 0 : FindBlock(prefix, false));
+    bool has_encoded = reader.Next();
+    auto new_word = new_words_.lower_bound(prefix);
+    for (size_t found = 0; found < limit && (has_encoded || new_word != new_words_.end());) {
+        const bool take_encoded = has_encoded && (new_word == new_words_.end() || reader.word() < new_word->first);
+        const std::string_view word = take_encoded ? reader.word() : std::string_view(new_word->first);
+        const int id = take_encoded ? reader.id() : new_word->second;
+        if (word.substr(0, prefix.size()) == prefix) {
+            if (!accept || accept(id)) {
+                callback(word, id);
+                ++found;
+            }
+        }
+        else if (word > prefix) {
+            return;
+        }
+        if (take_encoded) {
+            has_encoded = reader.Next();
+        }
+        else {
+            ++new_word;
+        }
+    }
+}
+
+size_t TermDictionary::size() const {
+    return ids_.size() + new_words_.size();
+}
+
+size_t TermDictionary::GetMemoryUsage() const {
+    size_t result = data_.capacity() + block_offsets_.capacity() * sizeof(uint32_t) + ids_.capacity() * sizeof(int);
+    for (const auto& [word, id] : new_words_) {
+        // Tree node: three pointers and the color besides the value
+        result += 4 * sizeof(void*) + sizeof(std::pmr::string) + sizeof(int) + (word.capacity() > 15 ? word.capacity() + 1 : 0);
+    }
+    return result;
+}
+
+std::string_view TermDictionary::GetBlockFirstWord(size_t block) const {
+    const char* pos = data_.data() + block_offsets_[block];
+    const uint32_t size = ReadVarint(pos);
+    return { pos, size };
+}
+
+size_t TermDictionary::FindBlock(std::string_view word, bool inclusive) const {
+    size_t low = 0;
+    size_t high = block_offsets_.size();
+    // First word of the first block is never moved past, so the result stays a valid block
+    while (high - low > 1) {
+        const size_t middle = (low + high) / 2;
+        const std::string_view first_word = GetBlockFirstWord(middle);
+        if (first_word < word || (inclusive && first_word == word)) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+int TermDictionary::FindEncoded(std::string_view word) const {
+    if (block_offsets_.empty()) return NOT_FOUND;
+    const size_t block = FindBlock(word, true);
+    const size_t end = std::min((block + 1) * BLOCK_SIZE, ids_.size());
+    const char* pos = data_.data() + block_offsets_[block];
+    // Words are compared in place: matched is the length of the common prefix of the previous word and the searched one,
+    // which is smaller at position matched while the scan goes on
+    size_t matched = 0;
+    for (size_t index = block * BLOCK_SIZE; index < end; ++index) {
+        const size_t shared = index % BLOCK_SIZE == 0 ? 0 : ReadVarint(pos);
+        const size_t suffix_size = ReadVarint(pos);
+        const std::string_view suffix(pos, suffix_size);
+        pos += suffix_size;
+        // The word keeps the smaller character of the previous one
+        if (shared > matched) continue;
+        // The word has a greater character than the previous one where it matched the searched one
+        if (shared < matched) return NOT_FOUND;
+        const std::string_view rest = word.substr(matched);
+        matched += CountCommonPrefix(suffix, rest);
+        const size_t suffix_matched = matched - shared;
+        if (suffix_matched == suffix.size()) {
+            if (suffix_matched == rest.size()) return ids_[index];
+            // A proper prefix of the searched word
+            continue;
+        }
+        // Characters are compared as unsigned, like in the sort order of the words
+        if (suffix_matched == rest.size() || static_cast<unsigned char>(suffix[suffix_matched]) > static_cast<unsigned char>(rest[suffix_matched])) {
+            return NOT_FOUND;
+        }
+    }
+    return NOT_FOUND;
+}
+
+void TermDictionary::Rebuild() {
+    TermDictionary rebuilt(new_words_.get_allocator().resource());
+    rebuilt.data_.reserve(data_.size() + new_words_.size() * 8);
+    rebuilt.ids_.reserve(ids_.size() + new_words_.size());
+    Writer writer(rebuilt);
+    Reader reader(*this, 0);
+    bool has_encoded = reader.Next();
+    auto new_word = new_words_.begin();
+    while (has_encoded || new_word != new_words_.end()) {
+        if (has_encoded && (new_word == new_words_.end() || reader.word() < new_word->first)) {
+            writer.Append(reader.word(), reader.id());
+            has_encoded = reader.Next();
+        }
+        else {
+            writer.Append(new_word->first, new_word->second);
+            ++new_word;
+        }
+    }
+    rebuilt.data_.shrink_to_fit();
+    data_ = std::move(rebuilt.data_);
+    block_offsets_ = std::move(rebuilt.block_offsets_);
+    ids_ = std::move(rebuilt.ids_);
+    new_words_.clear();
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The only copy of the indexed words. Sorted words are stored in front-coded blocks:
+// the first word of a block is kept whole, the rest as (shared prefix length, suffix).
+// Words added later wait in a small sorted map and are merged into the blocks once it grows
+class TermDictionary {
+public:
+    static const int NOT_FOUND = -1;
+
+    explicit TermDictionary(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    // Doesn't allocate
+    int Find(std::string_view word) const;
+    // The word must not be in the dictionary yet
+    void Insert(std::string_view word, int id);
+    // Calls callback(word, id) for up to limit words starting with prefix, in word order.
+    // Words rejected by accept are skipped and don't count against the limit. The word is valid during the call only
+    void FindByPrefix(std::string_view prefix, size_t limit, const std::function<bool(int)>& accept,
+                      const std::function<void(std::string_view, int)>& callback) const;
+    size_t size() const;
+    // Bytes taken by the words and ids
+    size_t GetMemoryUsage() const;
+
+private:
+    static const size_t BLOCK_SIZE = 16;
+
+    std::vector<char> data_;
+    std::vector<uint32_t> block_offsets_;
+    std::vector<int> ids_;
+    std::pmr::map<std::pmr::string, int, std::less<>> new_words_;
+
+    std::string_view GetBlockFirstWord(size_t block) const;
+    // Index of the last block whose first word is less than word (or equal, if inclusive)
+    size_t FindBlock(std::string_view word, bool inclusive) const;
+    int FindEncoded(std::string_view word) const;
+    // Merges the new words into the blocks
+    void Rebuild();
+
+    class Reader;
+    class Writer;
+};
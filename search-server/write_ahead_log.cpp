@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <execution>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "write_ahead_log.h"
+#include "binary_io.h"
+#include "search_server.h"
+
+using namespace std::literals;
+
+namespace {
+const size_t HEADER_SIZE = 2 * sizeof(uint32_t);
+// DurabilityLevel::NONE still hands data to the OS once this much is buffered
+const size_t MAX_BUFFER_SIZE = 1 << 20;
+const size_t RECOVERY_BATCH_SIZE = 4096;
+
+uint32_t ComputeCrc32(std::string_view data) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> result{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+            }
+            result[i] = value;
+        }
+        return result;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (const char c : data) {
+        crc = table[(crc ^ static_cast<unsigned char>(c)) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Closes the descriptor on every path out of the scope
+class FileDescriptor {
+public:
+    explicit FileDescriptor(int fd)
+        : fd_(fd) {}
+    ~FileDescriptor() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int Get() const {
+        return fd_;
+    }
+    bool Close() {
+        const int result = ::close(fd_);
+        fd_ = -1;
+        return result == 0;
+    }
+
+private:
+    int fd_;
+};
+
+void WriteAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t written = ::write(fd, data, size);
+        if (written < 0) throw std::runtime_error("Write-ahead log write failed");
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+// A rename is durable only once the directory entry reaches the disk
+void SyncParentDirectory(const std::string& path) {
+    const size_t slash = path.rfind('/');
+    const std::string directory = slash == std::string::npos ? "."s : slash == 0 ? "/"s : path.substr(0, slash);
+    const FileDescriptor fd(::open(directory.c_str(), O_RDONLY | O_DIRECTORY));
+    if (fd.Get() < 0) throw std::runtime_error("Can't open directory " + directory);
+    if (::fsync(fd.Get()) != 0) throw std::runtime_error("Can't sync directory " + directory);
+}
+
+std::string ReadFile(int fd) {
+    std::string content;
+    char chunk[1 << 16];
+    ::lseek(fd, 0, SEEK_SET);
+    for (ssize_t read = 0; (read = ::read(fd, chunk, sizeof(chunk))) != 0;) {
+        if (read < 0) throw std::runtime_error("Write-ahead log read failed");
+        content.append(chunk, static_cast<size_t>(read));
+    }
+    return content;
+}
+}
+
+WriteAheadLog::WriteAheadLog(const std::string& path, DurabilityLevel durability, size_t group_size, std::chrono::milliseconds max_group_delay)
+    : path_(path)
+    , durability_(durability)
+    , group_size_(std::max<size_t>(group_size, 1))
+    , max_group_delay_(max_group_delay) {
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) throw std::runtime_error("Can't open write-ahead log " + path_);
+    if (durability_ == DurabilityLevel::GROUP) {
+        flusher_ = std::thread([this] { FlushLoop(); });
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    if (flusher_.joinable()) {
+        {
+            std::lock_guard guard(mutex_);
+            stop_ = true;
+        }
+        group_started_.notify_all();
+        flusher_.join();
+    }
+    try {
+        Commit();
+    }
+    catch (const std::exception&) {
+    }
+    ::close(fd_);
+}
+
+void WriteAheadLog::LogAddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
+    AppendRecord(EncodeAdd(document_id, document, status, ratings));
+}
+
+void WriteAheadLog::LogRemoveDocument(int document_id) {
+    std::vector<char> payload;
+    PutValue(payload, RecordType::REMOVE);
+    PutValue(payload, document_id);
+    AppendRecord(payload);
+}
+
+void WriteAheadLog::Commit() {
+    std::lock_guard guard(mutex_);
+    if (flush_error_) std::rethrow_exception(flush_error_);
+    WriteBuffer(true);
+}
+
+void WriteAheadLog::FlushLoop() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+        group_started_.wait(lock, [this] { return stop_ || (buffered_records_ > 0 && !flush_error_); });
+        if (stop_) return;
+        // The group may fill up or be committed meanwhile, then a new one starts
+        const auto group_start = group_start_;
+        if (group_started_.wait_until(lock, group_start + max_group_delay_, [this, group_start] {
+                return stop_ || buffered_records_ == 0 || group_start_ != group_start;
+            })) {
+            continue;
+        }
+        try {
+            WriteBuffer(true);
+        }
+        catch (const std::runtime_error&) {
+            // Reported by the next Commit or append
+            flush_error_ = std::current_exception();
+        }
+    }
+}
+
+size_t WriteAheadLog::Recover(SearchServer& search_server) {
+    if (search_server.GetDocumentCount() != 0) throw std::logic_error("Recovery requires an empty server");
+    std::lock_guard guard(mutex_);
+    WriteBuffer(false);
+    // Recovered documents point into the log content instead of copying their texts
+    const auto content_storage = std::make_shared<const std::string>(ReadFile(fd_));
+    const std::string& content = *content_storage;
+
+    // Record boundaries are only known from the headers, so they are found sequentially;
+    // checksums and payloads are then verified and decoded in parallel
+    std::vector<std::string_view> payloads;
+    std::vector<uint32_t> checksums;
+    size_t pos = 0;
+    while (content.size() - pos >= HEADER_SIZE) {
+        uint32_t size = 0;
+        uint32_t checksum = 0;
+        std::memcpy(&size, content.data() + pos, sizeof(size));
+        std::memcpy(&checksum, content.data() + pos + sizeof(size), sizeof(checksum));
+        if (content.size() - pos - HEADER_SIZE < size) break;
+        payloads.emplace_back(content.data() + pos + HEADER_SIZE, size);
+        checksums.push_back(checksum);
+        pos += HEADER_SIZE + size;
+    }
+
+    std::vector<Record> records(payloads.size());
+    std::vector<char> valid(payloads.size());
+    std::transform(
+        std::execution::par,
+        payloads.begin(), payloads.end(),
+        valid.begin(),
+        [&](const std::string_view& payload) {
+            const size_t index = &payload - payloads.data();
+            return ComputeCrc32(payload) == checksums[index] && DecodeRecord(payload, records[index]);
+        }
+    );
+
+    // Everything after the first broken record is a torn tail
+    const size_t valid_count = std::find(valid.begin(), valid.end(), 0) - valid.begin();
+    records.resize(valid_count);
+    const size_t valid_size = valid_count == 0 ? 0 : payloads[valid_count - 1].data() + payloads[valid_count - 1].size() - content.data();
+    if (valid_size != content.size()) {
+        if (::ftruncate(fd_, static_cast<off_t>(valid_size)) != 0) throw std::runtime_error("Can't truncate write-ahead log");
+        if (::fsync(fd_) != 0) throw std::runtime_error("Can't sync write-ahead log " + path_);
+    }
+
+    // Only the last operation on every id matters
+    std::map<int, size_t> last_record;
+    for (size_t i = 0; i < records.size(); ++i) {
+        last_record[records[i].document_id] = i;
+    }
+    std::vector<size_t> to_add;
+    for (const auto [document_id, index] : last_record) {
+        if (records[index].type == RecordType::ADD) to_add.push_back(index);
+    }
+    std::sort(to_add.begin(), to_add.end());
+    // Batches go through the parallel AddDocuments, bounding the words prepared at once
+    std::vector<DocumentRecord> batch;
+    batch.reserve(std::min(to_add.size(), RECOVERY_BATCH_SIZE));
+    for (const size_t index : to_add) {
+        Record& record = records[index];
+        batch.push_back({ record.document_id, record.status, std::move(record.ratings), record.document });
+        if (batch.size() == RECOVERY_BATCH_SIZE) {
+            search_server.AddDocuments(batch, content_storage);
+            batch.clear();
+        }
+    }
+    search_server.AddDocuments(batch, content_storage);
+    return to_add.size();
+}
+
+void WriteAheadLog::Checkpoint(const SearchServer& search_server) {
+    std::lock_guard guard(mutex_);
+    const std::string temp_path = path_ + ".checkpoint";
+    FileDescriptor temp_fd(::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    if (temp_fd.Get() < 0) throw std::runtime_error("Can't create checkpoint " + temp_path);
+
+    std::vector<char> data;
+    for (const int document_id : search_server) {
+        // The average rating alone reproduces the same document rating
+        const std::vector<char> payload = EncodeAdd(
+            document_id,
+            search_server.GetDocumentText(document_id),
+            search_server.GetDocumentStatus(document_id),
+            { search_server.GetDocumentRating(document_id) });
+        PutValue(data, static_cast<uint32_t>(payload.size()));
+        PutValue(data, ComputeCrc32({ payload.data(), payload.size() }));
+        data.insert(data.end(), payload.begin(), payload.end());
+        if (data.size() >= MAX_BUFFER_SIZE) {
+            WriteAll(temp_fd.Get(), data.data(), data.size());
+            data.clear();
+        }
+    }
+    WriteAll(temp_fd.Get(), data.data(), data.size());
+    // The old log must stay in place unless the checkpoint is fully on the disk
+    if (::fsync(temp_fd.Get()) != 0 || !temp_fd.Close()) throw std::runtime_error("Can't sync checkpoint " + temp_path);
+
+    if (::rename(temp_path.c_str(), path_.c_str()) != 0) throw std::runtime_error("Can't replace write-ahead log " + path_);
+    SyncParentDirectory(path_);
+    ::close(fd_);
+    fd_ = ::open(path_.c_str(), O_RDWR | O_APPEND);
+    if (fd_ < 0) throw std::runtime_error("Can't open write-ahead log " + path_);
+    // Records buffered before the checkpoint are already part of it
+    buffer_.clear();
+    buffered_records_ = 0;
+}
+
+void WriteAheadLog::AppendRecord(const std::vector<char>& payload) {
+    std::lock_guard guard(mutex_);
+    if (flush_error_) std::rethrow_exception(flush_error_);
+    if (buffered_records_ == 0) {
+        group_start_ = std::chrono::steady_clock::now();
+        group_started_.notify_all();
+    }
+    PutValue(buffer_, static_cast<uint32_t>(payload.size()));
+    PutValue(buffer_, ComputeCrc32({ payload.data(), payload.size() }));
+    buffer_.insert(buffer_.end(), payload.begin(), payload.end());
+    ++buffered_records_;
+
+    switch (durability_) {
+    case DurabilityLevel::FULL:
+        WriteBuffer(true);
+        break;
+    case DurabilityLevel::GROUP:
+        if (buffered_records_ >= group_size_) WriteBuffer(true);
+        break;
+    case DurabilityLevel::NONE:
+        if (buffer_.size() >= MAX_BUFFER_SIZE) WriteBuffer(false);
+        break;
+    }
+}
+
+void WriteAheadLog::WriteBuffer(bool sync) {
+    if (!buffer_.empty()) {
+        WriteAll(fd_, buffer_.data(), buffer_.size());
+        buffer_.clear();
+        buffered_records_ = 0;
+    }
+    if (sync && ::fdatasync(fd_) != 0) throw std::runtime_error("Write-ahead log sync failed");
+}
+
+std::vector<char> WriteAheadLog::EncodeAdd(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
+    std::vector<char> payload;
+    payload.reserve(document.size() + ratings.size() * sizeof(int) + 16);
+    PutValue(payload, RecordType::ADD);
+    PutValue(payload, document_id);
+    PutValue(payload, static_cast<uint8_t>(status));
+    PutValue(payload, static_cast<uint32_t>(ratings.size()));
+    for (const int rating : ratings) {
+        PutValue(payload, rating);
+    }
+    PutString(payload, document);
+    return payload;
+}
+
+bool WriteAheadLog::DecodeRecord(std::string_view payload, Record& record) {
+    if (!GetValue(payload, record.type) || !GetValue(payload, record.document_id)) return false;
+    if (record.type == RecordType::REMOVE) return payload.empty();
+    if (record.type != RecordType::ADD) return false;
+
+    uint8_t status = 0;
+    uint32_t rating_count = 0;
+    if (!GetValue(payload, status) || !GetValue(payload, rating_count)) return false;
+    record.status = static_cast<DocumentStatus>(status);
+    if (payload.size() / sizeof(int) < rating_count) return false;
+    record.ratings.resize(rating_count);
+    for (int& rating : record.ratings) {
+        GetValue(payload, rating);
+    }
+    return GetString(payload, record.document) && payload.empty();
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "document.h"
+
+class SearchServer;
+
+enum class DurabilityLevel {
+    NONE,   // records reach the OS when the buffer fills up or on Commit
+    GROUP,  // one fsync per group of records, written once it is full or its first record waited max_group_delay
+    FULL,   // fsync after every record
+};
+
+// Append-only log of AddDocument/RemoveDocument calls, records are appended before the change is applied.
+// Every record is stored as [payload size][crc32 of payload][payload]
+class WriteAheadLog {
+public:
+    explicit WriteAheadLog(const std::string& path, DurabilityLevel durability = DurabilityLevel::GROUP, size_t group_size = 256,
+                           std::chrono::milliseconds max_group_delay = std::chrono::milliseconds(10));
+    ~WriteAheadLog();
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    void LogAddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    void LogRemoveDocument(int document_id);
+    // Writes buffered records and waits for them to reach the disk, a change may be acknowledged after that.
+    // Throws std::runtime_error, also if a background group write failed
+    void Commit();
+
+    // Replays the log into an empty server that has no log attached yet, documents are added in parallel batches
+    // and keep the read log content alive instead of copying their texts.
+    // A torn or corrupted tail is cut off. Returns the number of documents added
+    size_t Recover(SearchServer& search_server);
+    // Replaces the log with one add record per document of the server
+    void Checkpoint(const SearchServer& search_server);
+
+private:
+    enum class RecordType : uint8_t {
+        ADD = 1,
+        REMOVE = 2,
+    };
+
+    struct Record {
+        RecordType type;
+        int document_id;
+        DocumentStatus status;
+        std::vector<int> ratings;
+        std::string_view document;
+    };
+
+    const std::string path_;
+    const DurabilityLevel durability_;
+    const size_t group_size_;
+    const std::chrono::milliseconds max_group_delay_;
+    std::mutex mutex_;
+    int fd_ = -1;
+    std::vector<char> buffer_;
+    size_t buffered_records_ = 0;
+    // When the first buffered record was appended
+    std::chrono::steady_clock::time_point group_start_;
+    std::condition_variable group_started_;
+    std::exception_ptr flush_error_;
+    bool stop_ = false;
+    // Writes groups that waited too long, GROUP durability only
+    std::thread flusher_;
+
+    void FlushLoop();
+    void AppendRecord(const std::vector<char>& payload);
+    void WriteBuffer(bool sync);
+    static std::vector<char> EncodeAdd(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    static bool DecodeRecord(std::string_view payload, Record& record);
+};